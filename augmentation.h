@@ -0,0 +1,219 @@
+/* file: augmentation.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Random shifts, rotations and elastic distortions of the train objects applied to
+!    every chunk as it is read, in parallel and reproducibly for a seed
+!******************************************************************************/
+
+#ifndef _AUGMENTATION_H
+#define _AUGMENTATION_H
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include "image_dataset.h"
+
+struct AugmentationParameters
+{
+    /* Largest shift in pixels along each axis */
+    double maxShift;
+    /* Largest rotation in degrees */
+    double maxRotation;
+    /* Largest displacement in pixels of the elastic distortion, 0 disables it */
+    double elasticAlpha;
+    /* Cells per side of the grid of random displacements the elastic field is interpolated from,
+       fewer cells give a smoother distortion */
+    size_t elasticGrid;
+
+    AugmentationParameters() : maxShift(0), maxRotation(0), elasticAlpha(0), elasticGrid(4) { }
+
+    inline bool isEnabled() const { return maxShift > 0 || maxRotation > 0 || elasticAlpha > 0; }
+};
+
+/* SplitMix64, a stream of 64-bit values from a 64-bit state that is cheap to seed for every object */
+class AugmentationRandom
+{
+public:
+    AugmentationRandom(uint64_t seed) : _state(seed) { }
+
+    inline uint64_t next()
+    {
+        uint64_t z = (_state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    /* Uniform in [-range, range] */
+    inline double symmetric(double range)
+    {
+        return range * ((double)(next() >> 11) * (2.0 / 9007199254740992.0) - 1.0);
+    }
+
+private:
+    uint64_t _state;
+};
+
+/* Applies random transformations to the objects of another dataset as they are read. Read through
+   a ChunkPrefetcher, the objects are transformed on TBB workers of the prefetching thread, in the
+   chunk buffers of the prefetcher, while the network trains on the preceding chunk.
+   Every object draws from its own random stream keyed by the seed, the epoch and its position in
+   the epoch, so the result does not depend on the number of workers or on the chunk size */
+template<typename FPType>
+class AugmentedDataset : public DatasetChunkReader<FPType>
+{
+public:
+
+    AugmentedDataset(DatasetChunkReader<FPType> &source, const AugmentationParameters &parameters, uint64_t seed) :
+        _source(source), _parameters(parameters), _seed(seed), _epoch(0)
+    {
+        Collection<size_t> dims = source.getObjectDimensions();
+        _channels = dims[0];
+        _height = dims[1];
+        _width = dims[2];
+        _parameters.elasticGrid = std::max<size_t>(_parameters.elasticGrid, 1);
+    }
+
+    virtual ~AugmentedDataset() { }
+
+    /* Objects of different epochs get different transformations */
+    inline void setEpoch(size_t epoch) { _epoch = epoch; }
+
+    virtual size_t getNumberOfObjects() { return _source.getNumberOfObjects(); }
+    virtual Collection<size_t> getObjectDimensions() { return _source.getObjectDimensions(); }
+
+    virtual size_t getPosition() { return _source.getPosition(); }
+    virtual void seek(size_t objectIndex) { _source.seek(objectIndex); }
+
+    virtual size_t readChunk(FPType *data, FPType *labels, size_t maxObjects)
+    {
+        const size_t first = _source.getPosition();
+        const size_t count = _source.readChunk(data, labels, maxObjects);
+        augment(data, count, first, NULL);
+        return count;
+    }
+
+    virtual void readObjects(const size_t *indices, size_t numOfObjects, FPType *data, FPType *labels)
+    {
+        _source.readObjects(indices, numOfObjects, data, labels);
+        augment(data, numOfObjects, 0, indices);
+    }
+
+private:
+
+    /* Object i is keyed by indices[i] if given, by first + i otherwise */
+    void augment(FPType *data, size_t numOfObjects, size_t first, const size_t *indices)
+    {
+        ScopedPhase phase("augmentation");
+        const size_t objectSize = _channels * _height * _width;
+        const size_t grainSize = 16;
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, numOfObjects, grainSize), [&](const tbb::blocked_range<size_t> &range)
+        {
+            std::vector<FPType> original(objectSize);
+            std::vector<double> field;
+            for (size_t i = range.begin(); i < range.end(); i++)
+            {
+                const uint64_t key = indices ? indices[i] : first + i;
+                AugmentationRandom random(_seed ^ (_epoch * 0xD1B54A32D192ED03ULL) ^ (key * 0x8CB92BA72F3D8DD7ULL));
+                FPType *object = data + i * objectSize;
+                std::copy(object, object + objectSize, original.begin());
+                transform(&original[0], object, random, field);
+            }
+        });
+    }
+
+    /* Maps every output pixel back into the original object, rotation about the center, then the shift
+       and the elastic displacement, and samples the original bilinearly with zeros outside of it */
+    void transform(const FPType *original, FPType *object, AugmentationRandom &random, std::vector<double> &field) const
+    {
+        const double angle = random.symmetric(_parameters.maxRotation) * 3.14159265358979323846 / 180.0;
+        const double shiftX = random.symmetric(_parameters.maxShift);
+        const double shiftY = random.symmetric(_parameters.maxShift);
+        const double cosine = std::cos(angle), sine = std::sin(angle);
+        const double centerX = 0.5 * (_width - 1), centerY = 0.5 * (_height - 1);
+
+        const size_t grid = _parameters.elasticGrid;
+        const bool elastic = _parameters.elasticAlpha > 0;
+        if (elastic)
+        {
+            field.resize(2 * (grid + 1) * (grid + 1));
+            for (size_t j = 0; j < field.size(); j++)
+            {
+                field[j] = random.symmetric(_parameters.elasticAlpha);
+            }
+        }
+
+        for (size_t y = 0; y < _height; y++)
+        {
+            for (size_t x = 0; x < _width; x++)
+            {
+                const double u = x - centerX, v = y - centerY;
+                double sourceX = cosine * u + sine * v + centerX - shiftX;
+                double sourceY = -sine * u + cosine * v + centerY - shiftY;
+                if (elastic)
+                {
+                    double displacementX, displacementY;
+                    interpolateField(field, grid, x * (double)grid / std::max<size_t>(_width - 1, 1),
+                                     y * (double)grid / std::max<size_t>(_height - 1, 1), displacementX, displacementY);
+                    sourceX += displacementX;
+                    sourceY += displacementY;
+                }
+
+                for (size_t c = 0; c < _channels; c++)
+                {
+                    object[(c * _height + y) * _width + x] = sample(original + c * _height * _width, sourceX, sourceY);
+                }
+            }
+        }
+    }
+
+    /* Displacement at (gx, gy) in grid cells from the random vectors at the grid nodes */
+    static inline void interpolateField(const std::vector<double> &field, size_t grid, double gx, double gy,
+                                        double &displacementX, double &displacementY)
+    {
+        const size_t x0 = std::min((size_t)gx, grid - 1), y0 = std::min((size_t)gy, grid - 1);
+        const double fx = gx - x0, fy = gy - y0;
+        const size_t stride = grid + 1;
+        const double *n00 = &field[2 * (y0 * stride + x0)];
+        const double *n01 = n00 + 2;
+        const double *n10 = n00 + 2 * stride;
+        const double *n11 = n10 + 2;
+        displacementX = (1 - fy) * ((1 - fx) * n00[0] + fx * n01[0]) + fy * ((1 - fx) * n10[0] + fx * n11[0]);
+        displacementY = (1 - fy) * ((1 - fx) * n00[1] + fx * n01[1]) + fy * ((1 - fx) * n10[1] + fx * n11[1]);
+    }
+
+    inline FPType pixel(const FPType *plane, long x, long y) const
+    {
+        return (x < 0 || y < 0 || x >= (long)_width || y >= (long)_height) ? (FPType)0 : plane[y * _width + x];
+    }
+
+    inline FPType sample(const FPType *plane, double x, double y) const
+    {
+        const double fx0 = std::floor(x), fy0 = std::floor(y);
+        const long x0 = (long)fx0, y0 = (long)fy0;
+        const double fx = x - fx0, fy = y - fy0;
+        return (FPType)((1 - fy) * ((1 - fx) * pixel(plane, x0, y0) + fx * pixel(plane, x0 + 1, y0)) +
+                        fy * ((1 - fx) * pixel(plane, x0, y0 + 1) + fx * pixel(plane, x0 + 1, y0 + 1)));
+    }
+
+    DatasetChunkReader<FPType> &_source;
+    AugmentationParameters _parameters;
+    uint64_t _seed;
+    size_t _epoch;
+    size_t _channels;
+    size_t _height;
+    size_t _width;
+};
+
+#endif
@@ -0,0 +1,409 @@
+/* file: batch_pipeline.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Stages that deliver chunks of minibatches from a dataset reader to the trainer
+!******************************************************************************/
+
+#ifndef _BATCH_PIPELINE_H
+#define _BATCH_PIPELINE_H
+
+#include <deque>
+#include <random>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <exception>
+#include <condition_variable>
+#include "image_dataset.h"
+
+/* Blocking FIFO with a fixed capacity, close() wakes up all waiters */
+template<typename T>
+class BoundedQueue
+{
+public:
+
+    BoundedQueue(size_t capacity) : _capacity(capacity), _closed(false) { }
+
+    /* Returns false if the queue was closed */
+    bool push(const T &item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notFull.wait(lock, [this] { return _closed || _items.size() < _capacity; });
+        if (_closed) { return false; }
+        _items.push_back(item);
+        _notEmpty.notify_one();
+        return true;
+    }
+
+    /* Returns false if the queue was closed */
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notEmpty.wait(lock, [this] { return _closed || !_items.empty(); });
+        if (_closed) { return false; }
+        item = _items.front();
+        _items.pop_front();
+        _notFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _notFull.notify_all();
+        _notEmpty.notify_all();
+    }
+
+    void reopen()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _items.clear();
+        _closed = false;
+    }
+
+private:
+
+    size_t _capacity;
+    bool _closed;
+    std::deque<T> _items;
+    std::mutex _mutex;
+    std::condition_variable _notFull;
+    std::condition_variable _notEmpty;
+};
+
+/* Preallocated buffers for one chunk of objects and their ground truth */
+template<typename FPType>
+class TensorChunk
+{
+public:
+
+    SharedPtr<HomogenTensor<FPType> > data;
+    SharedPtr<HomogenTensor<FPType> > groundTruth;
+    size_t numOfObjects;
+    /* Set by a background reader that failed, the chunk then ends the data */
+    std::exception_ptr error;
+
+    TensorChunk(const Collection<size_t> &objectDims, size_t capacity) : numOfObjects(0)
+    {
+        Collection<size_t> dataDims;
+        dataDims.push_back(capacity);
+        for (size_t i = 0; i < objectDims.size(); i++)
+        {
+            dataDims.push_back(objectDims[i]);
+        }
+
+        Collection<size_t> groundTruthDims;
+        groundTruthDims.push_back(capacity);
+
+        data = makePooledTensor<FPType>(dataDims);
+        groundTruth = makePooledTensor<FPType>(groundTruthDims);
+
+        Profiler::getInstance().addAllocation("chunk buffers", (data->getSize() + groundTruth->getSize()) * sizeof(FPType));
+    }
+
+    inline size_t getCapacity() { return data->getDimensionSize(0); }
+
+    /* Tensors over the first n objects, sharing memory with the chunk buffers */
+    SharedPtr<Tensor> getData(size_t n) { return view(data, n); }
+    SharedPtr<Tensor> getGroundTruth(size_t n) { return view(groundTruth, n); }
+
+private:
+
+    SharedPtr<Tensor> view(const SharedPtr<HomogenTensor<FPType> > &tensor, size_t n)
+    {
+        if (n == getCapacity())
+        {
+            return tensor;
+        }
+        Collection<size_t> dims = tensor->getDimensions();
+        dims[0] = n;
+        return SharedPtr<Tensor>(new HomogenTensor<FPType>(dims, tensor->getArray()));
+    }
+};
+
+/* Reads chunks in a background thread into a ring of buffers, so that decoding and
+   normalization of chunk k+1 overlaps with computations on chunk k.
+   With zero buffers the chunks are read synchronously by the caller of next(). An error of the
+   background thread is passed with its chunk and rethrown by next() */
+template<typename FPType>
+class ChunkPrefetcher
+{
+public:
+
+    ChunkPrefetcher(DatasetChunkReader<FPType> &reader, size_t chunkSize, size_t numOfBuffers = 2) :
+        _reader(reader), _asynchronous(numOfBuffers > 0), _running(false),
+        _freeChunks(std::max<size_t>(numOfBuffers, 1)), _readyChunks(std::max<size_t>(numOfBuffers, 1)),
+        _stallTime(0)
+    {
+        Collection<size_t> objectDims = reader.getObjectDimensions();
+        for (size_t i = 0; i < std::max<size_t>(numOfBuffers, 1); i++)
+        {
+            _chunks.push_back(SharedPtr<TensorChunk<FPType> >(new TensorChunk<FPType>(objectDims, chunkSize)));
+        }
+    }
+
+    virtual ~ChunkPrefetcher() { stop(); }
+
+    /* Starts delivering chunks from the current position of the reader to its end */
+    void start()
+    {
+        stop();
+        _stallTime = 0;
+        _freeChunks.reopen();
+        _readyChunks.reopen();
+        for (size_t i = 0; i < _chunks.size(); i++)
+        {
+            _freeChunks.push(_chunks[i].get());
+        }
+
+        if (_asynchronous)
+        {
+            _running = true;
+            _producer = std::thread(&ChunkPrefetcher::produce, this);
+        }
+    }
+
+    /* Returns the next filled chunk or NULL at the end of the data.
+       The chunk must be given back with recycle() once it is not needed */
+    TensorChunk<FPType> *next()
+    {
+        std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+
+        TensorChunk<FPType> *chunk = NULL;
+        if (_asynchronous)
+        {
+            if (!_readyChunks.pop(chunk)) { chunk = NULL; }
+        }
+        else if (_freeChunks.pop(chunk))
+        {
+            fill(chunk);
+        }
+
+        _stallTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+
+        /* The error was stored before the chunk was queued, the queue orders it before this read */
+        if (chunk && chunk->error)
+        {
+            std::exception_ptr error = chunk->error;
+            stop();
+            std::rethrow_exception(error);
+        }
+
+        if (chunk && chunk->numOfObjects == 0)
+        {
+            stop();
+            return NULL;
+        }
+        return chunk;
+    }
+
+    void recycle(TensorChunk<FPType> *chunk)
+    {
+        _freeChunks.push(chunk);
+    }
+
+    /* Stops the background thread, the reader position is left after the last read chunk */
+    void stop()
+    {
+        _freeChunks.close();
+        _readyChunks.close();
+        if (_running)
+        {
+            _producer.join();
+            _running = false;
+        }
+    }
+
+    /* Seconds the consumer spent waiting for data since start() */
+    inline double getStallTime() { return _stallTime; }
+
+private:
+
+    void fill(TensorChunk<FPType> *chunk)
+    {
+        ScopedPhase phase("data load");
+        chunk->numOfObjects = _reader.readChunk(chunk->data->getArray(), chunk->groundTruth->getArray(), chunk->getCapacity());
+    }
+
+    void produce()
+    {
+        TensorChunk<FPType> *chunk;
+        while (_freeChunks.pop(chunk))
+        {
+            chunk->error = std::exception_ptr();
+            try
+            {
+                fill(chunk);
+            }
+            catch (...)
+            {
+                chunk->error = std::current_exception();
+                chunk->numOfObjects = 0;
+            }
+
+            if (!_readyChunks.push(chunk) || chunk->numOfObjects == 0)
+            {
+                break;
+            }
+        }
+    }
+
+    ChunkPrefetcher(const ChunkPrefetcher &);
+    ChunkPrefetcher &operator=(const ChunkPrefetcher &);
+
+    DatasetChunkReader<FPType> &_reader;
+    bool _asynchronous;
+    bool _running;
+    std::vector<SharedPtr<TensorChunk<FPType> > > _chunks;
+    BoundedQueue<TensorChunk<FPType> *> _freeChunks;
+    BoundedQueue<TensorChunk<FPType> *> _readyChunks;
+    std::thread _producer;
+    double _stallTime;
+};
+
+
+/* Presents the objects of another dataset in the order of an index permutation.
+   Chunks are gathered from the source, the source data itself is never reordered */
+template<typename FPType>
+class ShuffledDataset : public DatasetChunkReader<FPType>
+{
+public:
+
+    ShuffledDataset(DatasetChunkReader<FPType> &source) : _source(source), _position(0)
+    {
+        _permutation.resize(source.getNumberOfObjects());
+        for (size_t i = 0; i < _permutation.size(); i++)
+        {
+            _permutation[i] = i;
+        }
+    }
+
+    virtual ~ShuffledDataset() { }
+
+    /* Fisher-Yates shuffle with a generator whose sequence is fixed by the standard,
+       so that the same seed gives the same order on every platform */
+    void shuffle(uint64_t seed)
+    {
+        std::mt19937_64 generator(seed);
+        for (size_t i = _permutation.size(); i > 1; i--)
+        {
+            size_t j = (size_t)(generator() % i);
+            std::swap(_permutation[i - 1], _permutation[j]);
+        }
+        _position = 0;
+    }
+
+    virtual size_t getNumberOfObjects() { return _permutation.size(); }
+    virtual Collection<size_t> getObjectDimensions() { return _source.getObjectDimensions(); }
+
+    virtual size_t getPosition() { return _position; }
+    virtual void seek(size_t objectIndex) { _position = std::min(objectIndex, _permutation.size()); }
+
+    virtual size_t readChunk(FPType *data, FPType *labels, size_t maxObjects)
+    {
+        size_t count = std::min(maxObjects, _permutation.size() - _position);
+        if (count == 0)
+        {
+            return 0;
+        }
+        _source.readObjects(&_permutation[0] + _position, count, data, labels);
+        _position += count;
+        return count;
+    }
+
+    virtual void readObjects(const size_t *indices, size_t numOfObjects, FPType *data, FPType *labels)
+    {
+        if (numOfObjects == 0)
+        {
+            return;
+        }
+        std::vector<size_t> sourceIndices(numOfObjects);
+        for (size_t i = 0; i < numOfObjects; i++)
+        {
+            sourceIndices[i] = _permutation[indices[i]];
+        }
+        _source.readObjects(&sourceIndices[0], numOfObjects, data, labels);
+    }
+
+private:
+
+    DatasetChunkReader<FPType> &_source;
+    std::vector<size_t> _permutation;
+    size_t _position;
+};
+
+
+/* Contiguous range of objects of another dataset */
+template<typename FPType>
+class DatasetShard : public DatasetChunkReader<FPType>
+{
+public:
+
+    DatasetShard(DatasetChunkReader<FPType> &source, size_t firstObject, size_t numOfObjects) :
+        _source(source), _firstObject(firstObject), _numOfObjects(numOfObjects), _position(0)
+    {
+        if (firstObject + numOfObjects > source.getNumberOfObjects())
+        {
+            throw std::runtime_error("Shard is out of the dataset bounds");
+        }
+    }
+
+    /* Keeps the source alive for as long as the shard */
+    DatasetShard(const SharedPtr<DatasetChunkReader<FPType> > &source, size_t firstObject, size_t numOfObjects) :
+        DatasetShard(*source, firstObject, numOfObjects)
+    {
+        _owner = source;
+    }
+
+    virtual ~DatasetShard() { }
+
+    virtual size_t getNumberOfObjects() { return _numOfObjects; }
+    virtual Collection<size_t> getObjectDimensions() { return _source.getObjectDimensions(); }
+
+    virtual size_t getPosition() { return _position; }
+    virtual void seek(size_t objectIndex) { _position = std::min(objectIndex, _numOfObjects); }
+
+    virtual size_t readChunk(FPType *data, FPType *labels, size_t maxObjects)
+    {
+        size_t count = std::min(maxObjects, _numOfObjects - _position);
+        _source.seek(_firstObject + _position);
+        count = _source.readChunk(data, labels, count);
+        _position += count;
+        return count;
+    }
+
+    virtual void readObjects(const size_t *indices, size_t numOfObjects, FPType *data, FPType *labels)
+    {
+        if (numOfObjects == 0)
+        {
+            return;
+        }
+        std::vector<size_t> sourceIndices(numOfObjects);
+        for (size_t i = 0; i < numOfObjects; i++)
+        {
+            sourceIndices[i] = _firstObject + indices[i];
+        }
+        _source.readObjects(&sourceIndices[0], numOfObjects, data, labels);
+    }
+
+private:
+
+    DatasetChunkReader<FPType> &_source;
+    SharedPtr<DatasetChunkReader<FPType> > _owner;
+    size_t _firstObject;
+    size_t _numOfObjects;
+    size_t _position;
+};
+
+#endif
@@ -0,0 +1,160 @@
+/* file: bench_loader.cpp */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Startup benchmark of the dataset loaders: MNIST with std::ifstream vs mmap, the same
+!    files read as IDX shards, and optionally CIFAR batches and raw NCHW dumps
+!******************************************************************************/
+
+#include "image_dataset.h"
+#include "image_formats.h"
+
+typedef services::SharedPtr<Tensor> TensorPtr;
+
+#include "service.h"
+#include <chrono>
+#include <functional>
+
+const size_t TrainDataCount = 60000;
+const size_t TestDataCount = 10000;
+const size_t nRepeats = 5;
+
+string datasetFileNames[] =
+{
+    "./data/train-images-idx3-ubyte",
+    "./data/train-labels-idx1-ubyte",
+    "./data/t10k-images-idx3-ubyte",
+    "./data/t10k-labels-idx1-ubyte"
+};
+
+/* Comma-separated CIFAR batch files */
+string CifarBatches;
+/* Raw NCHW dump as <pixels>,<labels> and the sizes of its objects as CxHxW */
+string RawFiles;
+string RawDimensions = "1x28x28";
+
+double loadDataset(DatasetLoader loader)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    DatasetReader_MNIST<double> reader;
+    reader.setLoader(loader);
+    reader.setTrainBatch(datasetFileNames[0], datasetFileNames[1], TrainDataCount);
+    reader.setTestBatch(datasetFileNames[2], datasetFileNames[3], TestDataCount);
+    reader.read();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+/* Directory and file name of a path */
+void splitPath(const std::string &path, std::string &directory, std::string &name)
+{
+    size_t slash = path.find_last_of('/');
+    directory = slash == std::string::npos ? "." : path.substr(0, slash);
+    name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+}
+
+/* The MNIST files as one-shard datasets of IDX shards, selected by the part of the names before "-images" */
+double loadShards()
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < 4; i += 2)
+    {
+        std::string directory, name;
+        splitPath(datasetFileNames[i], directory, name);
+        DatasetReader_IDXShards<double> reader;
+        reader.open(directory, name.substr(0, name.find("-images") + 1), i == 0 ? TrainDataCount : TestDataCount);
+        reader.read();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+double loadCifar()
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    DatasetReader_CIFAR<double> reader;
+    reader.open(parseList(CifarBatches));
+    reader.read();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+double loadRaw(size_t channels, size_t height, size_t width)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<std::string> files = parseList(RawFiles);
+    DatasetReader_RawNCHW<double> reader(channels, height, width);
+    reader.open(files[0], files[1]);
+    reader.read();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+void runBenchmark(const char *name, const std::function<double()> &load, size_t numOfImages)
+{
+    double minTime = 0, totalTime = 0;
+    for (size_t i = 0; i < nRepeats; i++)
+    {
+        double time = load();
+        minTime = (i == 0 || time < minTime) ? time : minTime;
+        totalTime += time;
+    }
+
+    printf("%-8s min %8.4f s  mean %8.4f s  %12.0f images/s\n",
+           name, minTime, totalTime / nRepeats, numOfImages / minTime);
+}
+
+int main(int argc, char *argv[])
+{
+    CifarBatches = getStringOption(argc, argv, "cifar", CifarBatches);
+    RawFiles = getStringOption(argc, argv, "raw", RawFiles);
+    RawDimensions = getStringOption(argc, argv, "raw-dims", RawDimensions);
+    checkArguments(argc, argv, 4, &datasetFileNames[0], &datasetFileNames[1], &datasetFileNames[2], &datasetFileNames[3]);
+
+    printf("Loading %lu train + %lu test images, best of %lu runs\n", TrainDataCount, TestDataCount, nRepeats);
+
+    /* Warm up the page cache so that both loaders read from memory */
+    loadDataset(streamLoader);
+
+    const size_t images = TrainDataCount + TestDataCount;
+    runBenchmark("ifstream", [] { return loadDataset(streamLoader); }, images);
+    runBenchmark("mmap", [] { return loadDataset(mmapLoader); }, images);
+    runBenchmark("shards", loadShards, images);
+
+    if (!CifarBatches.empty())
+    {
+        DatasetReader_CIFAR<double> reader;
+        reader.open(parseList(CifarBatches));
+        runBenchmark("cifar", loadCifar, reader.getNumberOfObjects());
+    }
+
+    if (!RawFiles.empty())
+    {
+        unsigned long channels = 0, height = 0, width = 0;
+        if (parseList(RawFiles).size() != 2 || sscanf(RawDimensions.c_str(), "%lux%lux%lu", &channels, &height, &width) != 3)
+        {
+            printf("--raw takes <pixels>,<labels> and --raw-dims CxHxW\n");
+            return -1;
+        }
+        DatasetReader_RawNCHW<double> reader(channels, height, width);
+        reader.open(parseList(RawFiles)[0], parseList(RawFiles)[1]);
+        runBenchmark("raw", [=] { return loadRaw(channels, height, width); }, reader.getNumberOfObjects());
+    }
+
+    return 0;
+}
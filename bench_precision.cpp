@@ -0,0 +1,76 @@
+/* file: bench_precision.cpp */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Throughput and accuracy of the LeNet pipeline in single and double precision
+!******************************************************************************/
+
+#include "lenet_pipeline.h"
+#include "service.h"
+#include <chrono>
+
+size_t TrainDataCount = 50000;
+size_t TestDataCount = 10000;
+
+string datasetFileNames[] =
+{
+    "./data/train-images-idx3-ubyte",
+    "./data/train-labels-idx1-ubyte",
+    "./data/t10k-images-idx3-ubyte",
+    "./data/t10k-labels-idx1-ubyte"
+};
+
+inline double secondsSince(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template<typename FPType>
+void runBenchmark(const char *name)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    DatasetReader_MNIST<FPType> reader;
+    reader.setTrainBatch(datasetFileNames[0], datasetFileNames[1], TrainDataCount);
+    reader.setTestBatch(datasetFileNames[2], datasetFileNames[3], TestDataCount);
+    reader.read();
+    double loadTime = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    prediction::ModelPtr model = trainModel<FPType>(reader.getTrainData(), reader.getTrainGroundTruth(), TrainingParameters());
+    double trainTime = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    prediction::ResultPtr result = predict<FPType>(model, reader.getTestData());
+    double predictTime = secondsSince(start);
+
+    double accuracy = computeAccuracy<FPType>(result, reader.getTestGroundTruth());
+    size_t datasetBytes = (reader.getTrainData()->getSize() + reader.getTestData()->getSize()) * sizeof(FPType);
+
+    printf("%-7s %10.1f %12.1f %13.1f %10.4f %10.1f\n", name,
+           (TrainDataCount + TestDataCount) / loadTime, TrainDataCount / trainTime, TestDataCount / predictTime,
+           accuracy, datasetBytes / (1024.0 * 1024.0));
+}
+
+int main(int argc, char *argv[])
+{
+    TrainDataCount = getSizeOption(argc, argv, "train-count", TrainDataCount, 1);
+    TestDataCount = getSizeOption(argc, argv, "test-count", TestDataCount, 1);
+
+    checkArguments(argc, argv, 4, &datasetFileNames[0], &datasetFileNames[1], &datasetFileNames[2], &datasetFileNames[3]);
+
+    printf("%lu train and %lu test images\n", TrainDataCount, TestDataCount);
+    printf("%-7s %10s %12s %13s %10s %10s\n", "fptype", "load img/s", "train img/s", "predict img/s", "accuracy", "data MB");
+
+    runBenchmark<float>("float");
+    runBenchmark<double>("double");
+
+    return 0;
+}
@@ -0,0 +1,367 @@
+/* file: bench_suite.cpp */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Loading, training and inference throughput of the LeNet pipeline on deterministic
+!    synthetic MNIST-shaped IDX files, swept over FPType, threads, dataset size and batch size
+!******************************************************************************/
+
+#include "lenet_pipeline.h"
+#include "service.h"
+#include "threading.h"
+#include <chrono>
+#include <random>
+#include <thread>
+#include <cerrno>
+#include <sys/stat.h>
+#include <tbb/task_arena.h>
+
+const size_t ImageSide = 28;
+
+string DataDirectory = "./bench_data";
+uint64_t Seed = 777;
+size_t TestDataCount = 2000;
+size_t Repeats = 3;
+/* Comma-separated values of the swept parameters */
+string FPTypes = "float,double";
+string ThreadCounts;
+string TrainCounts = "5000,20000";
+string BatchSizes = "10,64";
+/* NUMA placements of the dataset tensors */
+string Placements = "default";
+/* Pinning of the TBB threads: none, compact or scatter */
+string Affinity = "none";
+/* Every measurement is also appended to this file, one line per configuration */
+string CsvPath;
+
+void writeDword(std::ofstream &stream, uint32_t value)
+{
+    const uint8_t bytes[4] = { (uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value };
+    stream.write((const char *)bytes, 4);
+}
+
+/* IDX files in the layout of the MNIST distribution. Every image is a bright disc whose position
+   depends on the label over uniform noise, so the network has something to learn.
+   Only the raw mt19937 output is used, it is the same for every standard library */
+void writeSyntheticDataset(const std::string &imagesPath, const std::string &labelsPath, size_t n, uint64_t seed)
+{
+    std::ofstream images(imagesPath.c_str(), std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+    std::ofstream labels(labelsPath.c_str(), std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+    if (!images.good() || !labels.good())
+    {
+        throw std::runtime_error("Unable to create synthetic dataset in " + DataDirectory);
+    }
+
+    writeDword(images, 0x00000803);
+    writeDword(images, (uint32_t)n);
+    writeDword(images, (uint32_t)ImageSide);
+    writeDword(images, (uint32_t)ImageSide);
+    writeDword(labels, 0x00000801);
+    writeDword(labels, (uint32_t)n);
+
+    std::mt19937 engine((uint32_t)seed);
+    std::vector<uint8_t> pixels(ImageSide * ImageSide);
+    for (size_t i = 0; i < n; i++)
+    {
+        const uint8_t label = (uint8_t)(engine() % 10);
+        const int centerX = 6 + (label % 5) * 4 + (int)(engine() % 3) - 1;
+        const int centerY = 9 + (label / 5) * 10 + (int)(engine() % 3) - 1;
+        for (size_t y = 0; y < ImageSide; y++)
+        {
+            for (size_t x = 0; x < ImageSide; x++)
+            {
+                const int dx = (int)x - centerX, dy = (int)y - centerY;
+                uint8_t value = (uint8_t)(engine() % 48);
+                if (dx * dx + dy * dy <= 16)
+                {
+                    value = (uint8_t)(192 + engine() % 64);
+                }
+                pixels[y * ImageSide + x] = value;
+            }
+        }
+        images.write((const char *)&pixels[0], pixels.size());
+        labels.write((const char *)&label, 1);
+    }
+
+    if (!images.good() || !labels.good())
+    {
+        throw std::runtime_error("Unable to write synthetic dataset in " + DataDirectory);
+    }
+}
+
+/* Files are named by size and seed and reused when they already exist */
+void prepareDataset(const std::string &name, size_t n, uint64_t seed, std::string &imagesPath, std::string &labelsPath)
+{
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".n%lu.s%lu", (unsigned long)n, (unsigned long)seed);
+    imagesPath = DataDirectory + "/" + name + "-images-idx3-ubyte" + suffix;
+    labelsPath = DataDirectory + "/" + name + "-labels-idx1-ubyte" + suffix;
+
+    struct stat imagesStat, labelsStat;
+    if (stat(imagesPath.c_str(), &imagesStat) == 0 && stat(labelsPath.c_str(), &labelsStat) == 0 &&
+        (size_t)imagesStat.st_size == 16 + n * ImageSide * ImageSide && (size_t)labelsStat.st_size == 8 + n)
+    {
+        return;
+    }
+    writeSyntheticDataset(imagesPath, labelsPath, n, seed);
+}
+
+/* Rates of the repetitions of one measurement */
+struct RateStatistics
+{
+    std::vector<double> rates;
+
+    void add(double numOfImages, double seconds) { rates.push_back(seconds > 0 ? numOfImages / seconds : 0.0); }
+
+    double mean() const
+    {
+        double sum = 0;
+        for (size_t i = 0; i < rates.size(); i++) { sum += rates[i]; }
+        return rates.empty() ? 0.0 : sum / rates.size();
+    }
+
+    /* Sample standard deviation */
+    double deviation() const
+    {
+        if (rates.size() < 2) { return 0.0; }
+        double m = mean(), sum = 0;
+        for (size_t i = 0; i < rates.size(); i++) { sum += (rates[i] - m) * (rates[i] - m); }
+        return std::sqrt(sum / (rates.size() - 1));
+    }
+
+    double minimum() const { return rates.empty() ? 0.0 : *std::min_element(rates.begin(), rates.end()); }
+    double maximum() const { return rates.empty() ? 0.0 : *std::max_element(rates.begin(), rates.end()); }
+};
+
+inline double secondsSince(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template<typename FPType>
+SharedPtr<DatasetReader_MNIST<FPType> > loadDataset(const std::string &trainImages, const std::string &trainLabels,
+                                                     size_t trainCount, const std::string &testImages,
+                                                     const std::string &testLabels, MemoryPlacement placement)
+{
+    SharedPtr<DatasetReader_MNIST<FPType> > reader(new DatasetReader_MNIST<FPType>());
+    reader->setMemoryPlacement(placement);
+    reader->setTrainBatch(trainImages, trainLabels, trainCount);
+    reader->setTestBatch(testImages, testLabels, TestDataCount);
+    reader->read();
+    return reader;
+}
+
+/* Prediction on consecutive batches of the test set, as a server scoring batchSize requests at a time */
+template<typename FPType>
+void predictInBatches(const prediction::ModelPtr &model, const TensorPtr &data, size_t batchSize)
+{
+    Collection<size_t> dims = data->getDimensions();
+    const size_t n = dims[0];
+    const size_t objectSize = data->getSize() / n;
+
+    SubtensorDescriptor<FPType> block;
+    data->getSubtensor(0, 0, 0, n, readOnly, block);
+    for (size_t first = 0; first < n; first += batchSize)
+    {
+        dims[0] = std::min(batchSize, n - first);
+        TensorPtr batch(new HomogenTensor<FPType>(dims, block.getPtr() + first * objectSize));
+        predict<FPType>(model, batch);
+    }
+    data->releaseSubtensor(block);
+}
+
+void printRate(const RateStatistics &statistics)
+{
+    printf(" %10.0f %7.1f%%", statistics.mean(), statistics.mean() > 0 ? 100.0 * statistics.deviation() / statistics.mean() : 0.0);
+}
+
+void writeCsv(FILE *csv, const char *fptype, size_t threads, MemoryPlacement placement, size_t trainCount, size_t batchSize,
+              const char *stage, const RateStatistics &statistics)
+{
+    if (!csv) { return; }
+    fprintf(csv, "%s,%lu,%s,%lu,%lu,%s,%lu,%.1f,%.1f,%.1f,%.1f\n", fptype, (unsigned long)threads,
+            getMemoryPlacementName(placement), (unsigned long)trainCount, (unsigned long)batchSize, stage, (unsigned long)statistics.rates.size(), statistics.mean(),
+            statistics.deviation(), statistics.minimum(), statistics.maximum());
+    fflush(csv);
+}
+
+template<typename FPType>
+void runBenchmark(const char *fptype, size_t threads, MemoryPlacement placement, size_t trainCount,
+                  const std::vector<size_t> &batchSizes,
+                  const std::string &trainImages, const std::string &trainLabels,
+                  const std::string &testImages, const std::string &testLabels, FILE *csv)
+{
+    /* The first load brings the files into the page cache and is not measured */
+    SharedPtr<DatasetReader_MNIST<FPType> > reader = loadDataset<FPType>(trainImages, trainLabels, trainCount, testImages, testLabels, placement);
+
+    RateStatistics load;
+    for (size_t r = 0; r < Repeats; r++)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        reader = loadDataset<FPType>(trainImages, trainLabels, trainCount, testImages, testLabels, placement);
+        load.add((double)(trainCount + TestDataCount), secondsSince(start));
+    }
+
+    for (size_t b = 0; b < batchSizes.size(); b++)
+    {
+        TrainingParameters parameters;
+        parameters.batchSize = batchSizes[b];
+        parameters.verbose = false;
+
+        RateStatistics train, inference;
+        double accuracy = 0;
+        for (size_t r = 0; r < Repeats; r++)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            prediction::ModelPtr model = trainModel<FPType>(reader->getTrainData(), reader->getTrainGroundTruth(), parameters);
+            train.add((double)(trainCount - trainCount % batchSizes[b]), secondsSince(start));
+
+            start = std::chrono::steady_clock::now();
+            predictInBatches<FPType>(model, reader->getTestData(), batchSizes[b]);
+            inference.add((double)TestDataCount, secondsSince(start));
+
+            accuracy = computeAccuracy<FPType>(predict<FPType>(model, reader->getTestData()), reader->getTestGroundTruth());
+        }
+
+        printf("%-7s %7lu %-10s %8lu %6lu", fptype, (unsigned long)threads, getMemoryPlacementName(placement),
+               (unsigned long)trainCount, (unsigned long)batchSizes[b]);
+        printRate(load);
+        printRate(train);
+        printRate(inference);
+        printf(" %9.4f\n", accuracy);
+        fflush(stdout);
+
+        writeCsv(csv, fptype, threads, placement, trainCount, batchSizes[b], "load", load);
+        writeCsv(csv, fptype, threads, placement, trainCount, batchSizes[b], "train", train);
+        writeCsv(csv, fptype, threads, placement, trainCount, batchSizes[b], "inference", inference);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    char defaultThreads[32];
+    snprintf(defaultThreads, sizeof(defaultThreads), "1,%u", std::max(std::thread::hardware_concurrency(), 1u));
+    ThreadCounts = defaultThreads;
+
+    DataDirectory = getStringOption(argc, argv, "data-dir", DataDirectory);
+    Seed = getSizeOption(argc, argv, "seed", Seed);
+    TestDataCount = getSizeOption(argc, argv, "test-count", TestDataCount, 1);
+    Repeats = std::max<size_t>(getSizeOption(argc, argv, "repeats", Repeats), 1);
+    FPTypes = getStringOption(argc, argv, "fptypes", FPTypes);
+    ThreadCounts = getStringOption(argc, argv, "threads", ThreadCounts);
+    TrainCounts = getStringOption(argc, argv, "train-counts", TrainCounts);
+    BatchSizes = getStringOption(argc, argv, "batch-sizes", BatchSizes);
+    CsvPath = getStringOption(argc, argv, "csv", CsvPath);
+    Placements = getStringOption(argc, argv, "numa", Placements);
+    Affinity = getStringOption(argc, argv, "affinity", Affinity);
+
+    std::vector<std::string> fptypes = parseList(FPTypes);
+    std::vector<size_t> threadCounts = parseSizeList(ThreadCounts);
+    std::vector<size_t> trainCounts = parseSizeList(TrainCounts, 1);
+    std::vector<size_t> batchSizes = parseSizeList(BatchSizes, 1);
+    std::vector<std::string> placementNames = parseList(Placements);
+    std::vector<MemoryPlacement> placements;
+    for (size_t p = 0; p < placementNames.size(); p++)
+    {
+        placements.push_back(parseMemoryPlacement(placementNames[p]));
+    }
+    if (fptypes.empty() || threadCounts.empty() || trainCounts.empty() || batchSizes.empty() || placements.empty() ||
+        TestDataCount == 0)
+    {
+        std::cout << "Every swept parameter needs at least one value" << std::endl;
+        return -1;
+    }
+
+    for (size_t f = 0; f < fptypes.size(); f++)
+    {
+        if (fptypes[f] != "float" && fptypes[f] != "double")
+        {
+            std::cout << "Unsupported floating-point type '" << fptypes[f] << "', use float or double" << std::endl;
+            return -1;
+        }
+    }
+
+    if (mkdir(DataDirectory.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        std::cout << "Unable to create " << DataDirectory << std::endl;
+        return -1;
+    }
+
+    /* One train file of the largest size serves all dataset sizes, readers take its first objects */
+    std::string trainImages, trainLabels, testImages, testLabels;
+    prepareDataset("train", *std::max_element(trainCounts.begin(), trainCounts.end()), Seed, trainImages, trainLabels);
+    prepareDataset("t10k", TestDataCount, Seed + 1, testImages, testLabels);
+
+    FILE *csv = NULL;
+    if (!CsvPath.empty())
+    {
+        csv = fopen(CsvPath.c_str(), "w");
+        if (!csv)
+        {
+            std::cout << "Unable to create " << CsvPath << std::endl;
+            return -1;
+        }
+        fprintf(csv, "fptype,threads,numa,train_count,batch_size,stage,repeats,mean_img_s,stddev_img_s,min_img_s,max_img_s\n");
+    }
+
+    SharedPtr<ThreadPinner> pinner;
+    if (Affinity != "none")
+    {
+        pinner = SharedPtr<ThreadPinner>(new ThreadPinner(Affinity));
+    }
+
+    printf("Synthetic dataset in %s, seed %lu, %lu test images, %lu repeats, %u hardware threads on %lu NUMA nodes, affinity %s\n",
+           DataDirectory.c_str(), (unsigned long)Seed, (unsigned long)TestDataCount, (unsigned long)Repeats,
+           std::thread::hardware_concurrency(), (unsigned long)getNumaNodes().size(), Affinity.c_str());
+    printf("Rates are images/s, mean and coefficient of variation over the repeats\n");
+    printf("%-7s %7s %-10s %8s %6s %10s %8s %10s %8s %10s %8s %9s\n", "fptype", "threads", "numa", "images", "batch",
+           "load", "cv", "train", "cv", "inference", "cv", "accuracy");
+
+    for (size_t f = 0; f < fptypes.size(); f++)
+    {
+        for (size_t t = 0; t < threadCounts.size(); t++)
+        {
+            const size_t threads = std::max<size_t>(threadCounts[t], 1);
+            Environment::getInstance()->setNumberOfThreads(threads);
+
+            /* Loaders parallelize with TBB directly, the arena holds them to the same number of threads */
+            tbb::task_arena arena((int)threads);
+            for (size_t p = 0; p < placements.size(); p++)
+            {
+                /* Recycled buffers keep the placement of their first use */
+                TensorPool::getInstance().trim();
+                for (size_t n = 0; n < trainCounts.size(); n++)
+                {
+                    arena.execute([&]()
+                    {
+                        if (fptypes[f] == "float")
+                        {
+                            runBenchmark<float>("float", threads, placements[p], trainCounts[n], batchSizes,
+                                                trainImages, trainLabels, testImages, testLabels, csv);
+                        }
+                        else
+                        {
+                            runBenchmark<double>("double", threads, placements[p], trainCounts[n], batchSizes,
+                                                 trainImages, trainLabels, testImages, testLabels, csv);
+                        }
+                    });
+                }
+            }
+        }
+    }
+
+    TensorPool::getInstance().print();
+
+    if (csv)
+    {
+        fclose(csv);
+    }
+    return 0;
+}
@@ -0,0 +1,376 @@
+/* file: checkpoint.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Training checkpoints with the weights, the optimizer state and the position in the
+!    train set, written by a background thread from a copy of the weights
+!******************************************************************************/
+
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <cerrno>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "daal.h"
+
+using namespace daal;
+using namespace daal::algorithms;
+using namespace daal::algorithms::neural_networks;
+using namespace daal::services;
+using namespace daal::data_management;
+
+/* Place in the training the checkpoint resumes from and the state of the SGD solver.
+   The solver keeps no state between minibatches besides its learning rate, so the count of
+   minibatches is recorded to continue the numbering of the run */
+struct TrainingCursor
+{
+    uint64_t epoch;
+    /* Objects of the epoch, in the order of its shuffle, that are already trained on */
+    uint64_t position;
+    /* Chunks of the epoch already trained on */
+    uint64_t chunk;
+    uint64_t numOfMinibatches;
+    double learningRate;
+    uint64_t seed;
+};
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t typeSize;
+    TrainingCursor cursor;
+    uint64_t numOfWeights;
+    /* FNV-1a of the cursor and the weights, a checkpoint cut short by a crash does not match it */
+    uint64_t checksum;
+};
+
+/* Checkpoints of one run are files checkpoint-<minibatches>.bin in a directory. A file is written under
+   a temporary name and renamed when complete, only the last keep checkpoints are kept. The directory is
+   created with the writer, a failed write is reported when it happens and again by the next snapshot */
+template<typename FPType>
+class CheckpointWriter
+{
+public:
+
+    static const uint32_t VERSION = 1;
+
+    CheckpointWriter(const std::string &directory, size_t keep = 2) :
+        _directory(directory), _keep(std::max<size_t>(keep, 1)), _pending(false), _writing(false), _stopping(false),
+        _numOfWrites(0), _numOfSkipped(0), _writeTime(0)
+    {
+        createDirectory(directory);
+        _thread = std::thread(&CheckpointWriter::run, this);
+    }
+
+    /* Creates the directory and its missing parents */
+    static void createDirectory(const std::string &directory)
+    {
+        for (size_t end = directory.find('/', 1); ; end = directory.find('/', end + 1))
+        {
+            const std::string path = directory.substr(0, end);
+            if (!path.empty() && mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+            {
+                throw std::runtime_error("Unable to create checkpoint directory " + path + ": " + strerror(errno));
+            }
+            if (end == std::string::npos)
+            {
+                break;
+            }
+        }
+
+        struct stat directoryStat;
+        if (stat(directory.c_str(), &directoryStat) != 0 || !S_ISDIR(directoryStat.st_mode))
+        {
+            throw std::runtime_error("Checkpoint directory " + directory + " is not a directory");
+        }
+    }
+
+    ~CheckpointWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _condition.notify_all();
+        _thread.join();
+    }
+
+    /* Copies the weights of the model and returns, the copy is written in the background.
+       A snapshot still waiting for the writer is replaced by the newer one. Throws if an earlier write failed */
+    void snapshot(const training::ModelPtr &model, const TrainingCursor &cursor)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_error.empty())
+            {
+                throw std::runtime_error(_error);
+            }
+        }
+
+        NumericTablePtr weights = model->getWeightsAndBiases();
+        BlockDescriptor<FPType> block;
+        weights->getBlockOfRows(0, weights->getNumberOfRows(), readOnly, block);
+        const FPType *values = block.getBlockPtr();
+        const size_t n = block.getNumberOfRows() * block.getNumberOfColumns();
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_pending)
+            {
+                _numOfSkipped++;
+            }
+            _snapshot.assign(values, values + n);
+            _snapshotCursor = cursor;
+            _pending = true;
+        }
+        weights->releaseBlockOfRows(block);
+        _condition.notify_all();
+    }
+
+    /* Blocks until the last snapshot is on disk */
+    void flush()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _condition.wait(lock, [this] { return !_pending && !_writing; });
+        if (!_error.empty())
+        {
+            throw std::runtime_error(_error);
+        }
+    }
+
+    inline size_t getNumberOfWrites() { return _numOfWrites; }
+    /* Snapshots replaced by a newer one before they were written */
+    inline size_t getNumberOfSkipped() { return _numOfSkipped; }
+    inline double getWriteTime() { return _writeTime; }
+
+    static uint64_t checksum(const TrainingCursor &cursor, const FPType *weights, size_t n)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        hash = fnv1a(hash, &cursor, sizeof(cursor));
+        return fnv1a(hash, weights, n * sizeof(FPType));
+    }
+
+    static std::string getFileName(const std::string &directory, uint64_t numOfMinibatches)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "checkpoint-%012lu.bin", (unsigned long)numOfMinibatches);
+        return directory + "/" + name;
+    }
+
+    /* Checkpoint files of the directory, the newest first */
+    static std::vector<std::string> list(const std::string &directory)
+    {
+        std::vector<std::string> names;
+        DIR *dir = opendir(directory.c_str());
+        if (!dir)
+        {
+            return names;
+        }
+        for (struct dirent *entry = readdir(dir); entry; entry = readdir(dir))
+        {
+            const std::string name = entry->d_name;
+            if (name.size() == 27 && name.compare(0, 11, "checkpoint-") == 0 && name.compare(23, 4, ".bin") == 0)
+            {
+                names.push_back(name);
+            }
+        }
+        closedir(dir);
+
+        std::sort(names.rbegin(), names.rend());
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            names[i] = directory + "/" + names[i];
+        }
+        return names;
+    }
+
+    /* Reads a checkpoint and checks it against its checksum, false if it is incomplete or damaged */
+    static bool read(const std::string &path, TrainingCursor &cursor, std::vector<FPType> &weights)
+    {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (!file)
+        {
+            return false;
+        }
+
+        CheckpointHeader header;
+        bool valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "LENETCK", 8) == 0 &&
+                     header.version == VERSION && header.typeSize == sizeof(FPType);
+        if (valid)
+        {
+            weights.resize(header.numOfWeights);
+            valid = (header.numOfWeights == 0 || fread(&weights[0], sizeof(FPType), weights.size(), file) == weights.size()) &&
+                    checksum(header.cursor, weights.empty() ? NULL : &weights[0], weights.size()) == header.checksum;
+        }
+        fclose(file);
+
+        if (valid)
+        {
+            cursor = header.cursor;
+        }
+        return valid;
+    }
+
+    /* Newest checkpoint of the directory that is complete, false if there is none */
+    static bool readLatest(const std::string &directory, TrainingCursor &cursor, std::vector<FPType> &weights,
+                           std::string *path = NULL)
+    {
+        std::vector<std::string> names = list(directory);
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            if (read(names[i], cursor, weights))
+            {
+                if (path) { *path = names[i]; }
+                return true;
+            }
+            fprintf(stderr, "Skipping damaged checkpoint %s\n", names[i].c_str());
+        }
+        return false;
+    }
+
+    /* Overwrites the weights of an initialized model */
+    static void restore(const training::ModelPtr &model, const std::vector<FPType> &values)
+    {
+        NumericTablePtr weights = model->getWeightsAndBiases();
+        BlockDescriptor<FPType> block;
+        weights->getBlockOfRows(0, weights->getNumberOfRows(), writeOnly, block);
+        const size_t n = block.getNumberOfRows() * block.getNumberOfColumns();
+        if (n != values.size())
+        {
+            weights->releaseBlockOfRows(block);
+            throw std::runtime_error("Checkpoint does not match the topology of the network");
+        }
+        std::copy(values.begin(), values.end(), block.getBlockPtr());
+        weights->releaseBlockOfRows(block);
+        model->setWeightsAndBiases(weights);
+    }
+
+private:
+
+    static uint64_t fnv1a(uint64_t hash, const void *ptr, size_t size)
+    {
+        const unsigned char *bytes = (const unsigned char *)ptr;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    void run()
+    {
+        std::vector<FPType> weights;
+        TrainingCursor cursor;
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;)
+        {
+            _condition.wait(lock, [this] { return _pending || _stopping; });
+            if (!_pending)
+            {
+                return;
+            }
+            weights.swap(_snapshot);
+            cursor = _snapshotCursor;
+            _pending = false;
+            _writing = true;
+
+            lock.unlock();
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::string error;
+            try
+            {
+                write(cursor, weights);
+            }
+            catch (std::exception &e)
+            {
+                error = e.what();
+                fprintf(stderr, "%s\n", error.c_str());
+            }
+            double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            lock.lock();
+
+            _writing = false;
+            _writeTime += time;
+            if (error.empty()) { _numOfWrites++; }
+            else { _error = error; }
+            _condition.notify_all();
+        }
+    }
+
+    void write(const TrainingCursor &cursor, const std::vector<FPType> &weights)
+    {
+        CheckpointHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "LENETCK", 8);
+        header.version = VERSION;
+        header.typeSize = sizeof(FPType);
+        header.cursor = cursor;
+        header.numOfWeights = weights.size();
+        header.checksum = checksum(cursor, weights.empty() ? NULL : &weights[0], weights.size());
+
+        const std::string path = getFileName(_directory, cursor.numOfMinibatches);
+        const std::string temporaryPath = path + ".tmp";
+        FILE *file = fopen(temporaryPath.c_str(), "wb");
+        if (!file)
+        {
+            throw std::runtime_error("Unable to write checkpoint " + temporaryPath + ": " + strerror(errno));
+        }
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                       (weights.empty() || fwrite(&weights[0], sizeof(FPType), weights.size(), file) == weights.size()) &&
+                       fflush(file) == 0 && fsync(fileno(file)) == 0;
+        written = (fclose(file) == 0) && written;
+        if (!written || rename(temporaryPath.c_str(), path.c_str()) != 0)
+        {
+            const std::string reason = strerror(errno);
+            unlink(temporaryPath.c_str());
+            throw std::runtime_error("Unable to write checkpoint " + path + ": " + reason);
+        }
+
+        std::vector<std::string> names = list(_directory);
+        for (size_t i = _keep; i < names.size(); i++)
+        {
+            unlink(names[i].c_str());
+        }
+    }
+
+    CheckpointWriter(const CheckpointWriter &);
+    CheckpointWriter &operator=(const CheckpointWriter &);
+
+    std::string _directory;
+    size_t _keep;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::vector<FPType> _snapshot;
+    TrainingCursor _snapshotCursor;
+    bool _pending;
+    bool _writing;
+    bool _stopping;
+    std::string _error;
+    size_t _numOfWrites;
+    size_t _numOfSkipped;
+    double _writeTime;
+};
+
+#endif
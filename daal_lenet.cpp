@@ -10,14 +10,39 @@
 #include "daal_lenet.h"
 #include "service.h"
 #include "image_dataset.h"
+#include "lenet_pipeline.h"
+#include "data_parallel.h"
+#include "model_file.h"
+#include "lenet_quantized.h"
+#include "instrumentation.h"
+#include "sweep.h"
+#include "threading.h"
 #include <cmath>
+#include <cstdio>
+#include <chrono>
+#include <thread>
 #include <iostream>
+#include <tbb/task_arena.h>
 
 using namespace std;
 
-void train();
-void test();
-bool checkResult();
+/* Floating-point type of the whole pipeline, --fptype overrides the build-time default */
+#ifndef LENET_FPTYPE
+#define LENET_FPTYPE "double"
+#endif
+
+template<typename FPType> int runLeNet();
+template<typename FPType> bool planMemory(DatasetReader_MNIST<FPType> &reader);
+template<typename FPType> void sweep();
+template<typename FPType> void train(DatasetReader_MNIST<FPType> &reader);
+template<typename FPType> void trainReplicas(DatasetReader_MNIST<FPType> &reader, DatasetChunkReader<FPType> &trainData);
+template<typename FPType>
+SharedPtr<DatasetChunkReader<FPType> > readTrainData(DatasetReader_MNIST<FPType> &reader, const ShardRange &range);
+template<typename FPType> void saveModel(DatasetReader_MNIST<FPType> &reader);
+template<typename FPType> void test();
+template<typename FPType> void testStreaming();
+template<typename FPType> void testQuantized(double referenceTime);
+template<typename FPType> bool checkResult();
 
 TensorPtr _trainingData;
 TensorPtr _trainingGroundTruth;
@@ -25,11 +50,69 @@ TensorPtr _testingData;
 TensorPtr _testingGroundTruth;
 size_t TrainDataCount = 50000;
 size_t TestDataCount = 100;
+string FPTypeName = LENET_FPTYPE;
+TrainingParameters Parameters;
+
+bool StreamingTraining = false;
+/* Keep the train set as uint8 pixels and expand it one chunk at a time */
+bool CompactTrainData = false;
+/* Directory for preprocessed dataset tensors, empty disables the cache */
+string CacheDirectory;
+
+/* Train replicas in this many processes on shards of the train set */
+size_t NumberOfProcesses = 1;
+/* Chunks of minibatches between weights exchanges of the replicas, 0 exchanges once per epoch */
+size_t SyncInterval = 10;
+/* Repeat the training in one process to measure the scaling efficiency */
+bool ScalingBaseline = false;
+ProcessGroup Processes;
+/* File the trained model is saved to for lenet_infer.exe, empty does not save it */
+string ModelPath;
+
+/* Also test an int8 copy of the trained model calibrated on the first train objects */
+bool Quantize = false;
+size_t CalibrationCount = 1000;
+/* Largest accuracy drop of the int8 model that checkResult accepts */
+double MaxAccuracyLoss = 0.01;
+/* Test accuracy checkResult requires */
+double MinAccuracy = 0.9;
+/* Predict the test set in chunks read from the files instead of loading it */
+bool StreamingTest = false;
+size_t TestChunkSize = 1000;
+/* Print the class probabilities of every test object */
+bool PrintClasses = false;
+/* Largest k of the reported top-k accuracies */
+size_t TopK = 3;
+/* Text file with the network topology, empty trains the one of configureNet */
+string TopologyPath;
+/* Warn when the network needs more MB than this for one minibatch, 0 disables the check */
+double MemoryBudget = 0;
+/* Print the memory plan of the network and exit */
+bool PlanOnly = false;
+/* Threads of DAAL and TBB, 0 uses all cores or the share of this process in data-parallel training */
+size_t NumberOfThreads = 0;
+/* Pinning of the TBB threads: none, compact or scatter */
+string Affinity = "none";
+/* NUMA placement of the dataset tensors: default, interleave or local */
+string Placement = "default";
+MemoryPlacement PlacementMode = placementDefault;
+/* Train and test every combination of the comma-separated values on one copy of the dataset */
+bool Sweep = false;
+string SweepLearningRates;
+string SweepBatchSizes;
+/* Kernels of the two convolutions as KxK, e.g. 32x64,16x32 */
+string SweepKernels;
+/* Configurations trained at a time, 0 runs as many as there are cores */
+size_t SweepJobs = 0;
+/* JSON file with phase and layer times, allocations and peak memory written at exit, empty disables it */
+string ProfilePath;
 
 prediction::ModelPtr _predictionModel;
 prediction::ResultPtr _predictionResult;
+Evaluation _evaluation;
+Evaluation _quantizedEvaluation;
 
-const string datasetFileNames[] =
+string datasetFileNames[] =
 {
     "./data/train-images-idx3-ubyte",
     "./data/train-labels-idx1-ubyte",
@@ -39,15 +122,155 @@ const string datasetFileNames[] =
 
 int main(int argc, char *argv[])
 {
+    TrainDataCount = getSizeOption(argc, argv, "train-count", TrainDataCount, 1);
+    TestDataCount = getSizeOption(argc, argv, "test-count", TestDataCount, 1);
+    FPTypeName = getStringOption(argc, argv, "fptype", FPTypeName);
+    StreamingTraining = getFlagOption(argc, argv, "stream");
+    CompactTrainData = getFlagOption(argc, argv, "compact");
+    Parameters.batchSize = getSizeOption(argc, argv, "batch-size", Parameters.batchSize, 1);
+    const double learningRate = getDoubleOption(argc, argv, "learning-rate", NAN);
+    if (!std::isnan(learningRate))
+    {
+        Parameters.learningRate = learningRate;
+        Parameters.learningRateGiven = true;
+    }
+    Parameters.numberOfEpochs = getSizeOption(argc, argv, "epochs", Parameters.numberOfEpochs, 1);
+    Parameters.shuffle = getFlagOption(argc, argv, "shuffle");
+    Parameters.seed = getSizeOption(argc, argv, "seed", Parameters.seed);
+    Parameters.probeSize = getSizeOption(argc, argv, "probe-size", Parameters.probeSize);
+    Parameters.batchesPerChunk = getSizeOption(argc, argv, "batches-per-chunk", Parameters.batchesPerChunk, 1);
+    Parameters.prefetchBuffers = getSizeOption(argc, argv, "prefetch", Parameters.prefetchBuffers);
+    CacheDirectory = getStringOption(argc, argv, "cache-dir", CacheDirectory);
+    NumberOfProcesses = getSizeOption(argc, argv, "processes", NumberOfProcesses, 1);
+    SyncInterval = getSizeOption(argc, argv, "sync-interval", SyncInterval);
+    ScalingBaseline = getFlagOption(argc, argv, "scaling-baseline");
+    ModelPath = getStringOption(argc, argv, "save-model", ModelPath);
+    Parameters.checkpointDirectory = getStringOption(argc, argv, "checkpoint-dir", Parameters.checkpointDirectory);
+    /* A checkpoint every 10 chunks of minibatches unless set otherwise */
+    Parameters.checkpointInterval = getSizeOption(argc, argv, "checkpoint-interval", 10);
+    Parameters.resume = getFlagOption(argc, argv, "resume");
+    Parameters.augmentation.maxShift = getDoubleOption(argc, argv, "augment-shift", Parameters.augmentation.maxShift);
+    Parameters.augmentation.maxRotation = getDoubleOption(argc, argv, "augment-rotation", Parameters.augmentation.maxRotation);
+    Parameters.augmentation.elasticAlpha = getDoubleOption(argc, argv, "augment-elastic", Parameters.augmentation.elasticAlpha);
+    Parameters.augmentation.elasticGrid = getSizeOption(argc, argv, "augment-elastic-grid", Parameters.augmentation.elasticGrid);
+    /* Held-out objects are the last --validation-size of the --train-count train objects */
+    Parameters.validation.holdoutSize = getSizeOption(argc, argv, "validation-size", Parameters.validation.holdoutSize);
+    Parameters.validation.interval = getSizeOption(argc, argv, "validation-interval", Parameters.validation.interval);
+    Parameters.validation.targetAccuracy = getDoubleOption(argc, argv, "target-accuracy", Parameters.validation.targetAccuracy);
+    Parameters.validation.patience = getSizeOption(argc, argv, "patience", Parameters.validation.patience);
+    Parameters.validation.minDelta = getDoubleOption(argc, argv, "min-delta", Parameters.validation.minDelta);
+    Quantize = getFlagOption(argc, argv, "int8");
+    CalibrationCount = getSizeOption(argc, argv, "calibration-count", CalibrationCount, 1);
+    MaxAccuracyLoss = getDoubleOption(argc, argv, "max-accuracy-loss", MaxAccuracyLoss);
+    MinAccuracy = getDoubleOption(argc, argv, "min-accuracy", MinAccuracy);
+    ProfilePath = getStringOption(argc, argv, "profile", ProfilePath);
+    PrintClasses = getFlagOption(argc, argv, "print-classes");
+    StreamingTest = getFlagOption(argc, argv, "stream-test");
+    TestChunkSize = getSizeOption(argc, argv, "test-chunk", TestChunkSize, 1);
+    TopK = getSizeOption(argc, argv, "top-k", TopK, 1);
+    TopologyPath = getStringOption(argc, argv, "topology", TopologyPath);
+    MemoryBudget = getDoubleOption(argc, argv, "memory-budget", MemoryBudget);
+    PlanOnly = getFlagOption(argc, argv, "plan");
+    Sweep = getFlagOption(argc, argv, "sweep");
+    SweepLearningRates = getStringOption(argc, argv, "sweep-learning-rates", SweepLearningRates);
+    SweepBatchSizes = getStringOption(argc, argv, "sweep-batch-sizes", SweepBatchSizes);
+    SweepKernels = getStringOption(argc, argv, "sweep-kernels", SweepKernels);
+    SweepJobs = getSizeOption(argc, argv, "sweep-jobs", SweepJobs);
+    NumberOfThreads = getSizeOption(argc, argv, "threads", NumberOfThreads);
+    Affinity = getStringOption(argc, argv, "affinity", Affinity);
+    Placement = getStringOption(argc, argv, "numa", Placement);
+    PlacementMode = parseMemoryPlacement(Placement);
 
     checkArguments(argc, argv, 4, &datasetFileNames[0], &datasetFileNames[1], &datasetFileNames[2], &datasetFileNames[3]);
 
+    /* Replicas that stop at different times would wait for each other's weights forever */
+    if (Parameters.validation.isEnabled() && NumberOfProcesses > 1)
+    {
+        std::cout << "--validation-size needs the training in one process" << std::endl;
+        return -1;
+    }
+
+    if (Sweep && (StreamingTraining || CompactTrainData || StreamingTest || NumberOfProcesses > 1))
+    {
+        std::cout << "--sweep needs the train and test sets loaded into one process" << std::endl;
+        return -1;
+    }
+
+    if (NumberOfProcesses > 1)
+    {
+        /* Workers are forked before DAAL or TBB start any threads and split the cores between them */
+        if (Processes.spawn(NumberOfProcesses) > 0)
+        {
+            if (!freopen("/dev/null", "w", stdout)) { return -1; }
+        }
+        if (NumberOfThreads == 0)
+        {
+            NumberOfThreads = std::max<size_t>(std::thread::hardware_concurrency() / NumberOfProcesses, 1);
+        }
+    }
+
+    /* DAAL gets the thread count directly, the loaders and kernels that call TBB run in an arena of it */
+    if (NumberOfThreads > 0)
+    {
+        Environment::getInstance()->setNumberOfThreads(NumberOfThreads);
+    }
+    tbb::task_arena arena(NumberOfThreads > 0 ? (int)NumberOfThreads : tbb::task_arena::automatic);
+    SharedPtr<ThreadPinner> pinner;
+    if (Affinity != "none")
+    {
+        pinner = SharedPtr<ThreadPinner>(new ThreadPinner(Affinity));
+    }
+
+    /* Only rank 0 writes the profile, workers would overwrite it with their shard's numbers */
+    if (!ProfilePath.empty() && Processes.getRank() == 0)
+    {
+        Profiler::getInstance().enable(ProfilePath);
+    }
+
+    int status = 0;
+    if (FPTypeName == "float")
+    {
+        arena.execute([&]() { status = runLeNet<float>(); });
+        return status;
+    }
+    else if (FPTypeName == "double")
+    {
+        arena.execute([&]() { status = runLeNet<double>(); });
+        return status;
+    }
+
+    std::cout << "Unsupported floating-point type '" << FPTypeName << "', use float or double" << std::endl;
+    return -1;
+}
+
+template<typename FPType>
+int runLeNet()
+{
+    DatasetReader_MNIST<FPType> reader;
+    if (!TopologyPath.empty())
+    {
+        Parameters.topology = SharedPtr<TopologyConfig>(new TopologyConfig(TopologyConfig::load(TopologyPath)));
+    }
+    /* Both precisions train the network of daal_lenet.h, whose layers compute in the default
+       floating-point type of DAAL like in the original sample */
+    Parameters.configureNet = configureNet;
+    if (!planMemory<FPType>(reader))
+    {
+        return 0;
+    }
+
     printf("Data loading started... \n");
 
-    DatasetReader_MNIST<double> reader;
-    reader.setTrainBatch(datasetFileNames[0], datasetFileNames[1], TrainDataCount);
-    reader.setTestBatch(datasetFileNames[2], datasetFileNames[3], TestDataCount);
-    reader.read();
+    reader.setCacheDirectory(CacheDirectory);
+    reader.setMemoryPlacement(PlacementMode);
+    /* Streamed, compact and data-parallel training read their objects when training starts */
+    reader.setTrainBatch(datasetFileNames[0], datasetFileNames[1],
+                         StreamingTraining || CompactTrainData || Processes.getSize() > 1 ? 0 : TrainDataCount);
+    reader.setTestBatch(datasetFileNames[2], datasetFileNames[3], Processes.getRank() == 0 && !StreamingTest ? TestDataCount : 0);
+    {
+        ScopedPhase phase("data load");
+        reader.read();
+    }
 
     printf("Data loaded \n");
 
@@ -56,16 +279,32 @@ int main(int argc, char *argv[])
     _testingData = reader.getTestData();
     _testingGroundTruth = reader.getTestGroundTruth();
 
+    if (Sweep)
+    {
+        sweep<FPType>();
+        return 0;
+    }
+
     printf("LeNet training started... \n");
 
-    train();
+    train<FPType>(reader);
+
+    if (Processes.getRank() > 0)
+    {
+        return 0;
+    }
 
     printf("LeNet training completed \n");
+
+    if (!ModelPath.empty())
+    {
+        saveModel<FPType>(reader);
+    }
     printf("LeNet testing started \n");
 
-    test();
+    test<FPType>();
 
-    if (checkResult())
+    if (checkResult<FPType>())
     {
         return 0;
     }
@@ -75,89 +314,306 @@ int main(int argc, char *argv[])
     }
 }
 
+/*Shapes and memory of the network layers for the minibatch size, computed before any data is read.
+  Returns false if only the plan was requested*/
+template<typename FPType>
+bool planMemory(DatasetReader_MNIST<FPType> &reader)
+{
+    if (!PlanOnly && MemoryBudget <= 0 && TopologyPath.empty())
+    {
+        return true;
+    }
+
+    Collection<size_t> objectDims;
+    objectDims.push_back(reader.numberOfChannels);
+    objectDims.push_back(reader.objectHeight);
+    objectDims.push_back(reader.objectWidth);
+
+    TopologyConfig topology = getTopologyConfig(Parameters);
+    MemoryPlan plan = topology.plan(objectDims, Parameters.batchSize, sizeof(FPType));
+    if (Processes.getRank() > 0)
+    {
+        return true;
+    }
+
+    if (PlanOnly || !TopologyPath.empty())
+    {
+        plan.print();
+    }
+
+    const size_t budgetBytes = (size_t)(MemoryBudget * 1024 * 1024);
+    if (budgetBytes > 0 && plan.getTotalBytes() > budgetBytes)
+    {
+        printf("Warning: the network needs %.2f MB for minibatches of %lu, more than the budget of %.2f MB. "
+               "The largest minibatch within the budget is %lu\n",
+               plan.getTotalBytes() / (1024.0 * 1024.0), (unsigned long)Parameters.batchSize, MemoryBudget,
+               (unsigned long)plan.getMaxBatchSize(budgetBytes));
+    }
+    return !PlanOnly;
+}
+
+/*Hyperparameter sweep on the loaded train and test tensors, unset lists keep the value of the single run*/
+template<typename FPType>
+void sweep()
+{
+    std::vector<double> learningRates = parseDoubleList(SweepLearningRates);
+    if (learningRates.empty()) { learningRates.push_back(Parameters.learningRate); }
+    std::vector<size_t> batchSizes = parseSizeList(SweepBatchSizes, 1);
+    if (batchSizes.empty()) { batchSizes.push_back(Parameters.batchSize); }
+
+    std::vector<std::pair<size_t, size_t> > kernels;
+    std::vector<std::string> kernelItems = parseList(SweepKernels);
+    for (size_t i = 0; i < kernelItems.size(); i++)
+    {
+        size_t kernels1 = 0, kernels2 = 0;
+        if (sscanf(kernelItems[i].c_str(), "%lux%lu", (unsigned long *)&kernels1, (unsigned long *)&kernels2) != 2 ||
+            kernels1 == 0 || kernels2 == 0)
+        {
+            throw std::runtime_error("Kernel counts '" + kernelItems[i] + "' are not of the form KxK");
+        }
+        kernels.push_back(std::make_pair(kernels1, kernels2));
+    }
+    if (kernels.empty()) { kernels.push_back(std::make_pair<size_t, size_t>(0, 0)); }
+
+    std::vector<SweepConfiguration> configurations = makeSweepGrid(learningRates, batchSizes, kernels);
+    const size_t numOfThreads = NumberOfThreads ? NumberOfThreads : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    const size_t numOfJobs = std::min(SweepJobs ? SweepJobs : numOfThreads, configurations.size());
+
+    printf("Sweep of %lu configurations, %lu at a time on %lu threads, on one copy of %lu train and %lu test objects\n",
+           (unsigned long)configurations.size(), (unsigned long)numOfJobs, (unsigned long)numOfThreads,
+           (unsigned long)_trainingData->getDimensionSize(0), (unsigned long)_testingData->getDimensionSize(0));
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<SweepResult> results = runSweep<FPType>(_trainingData, _trainingGroundTruth, _testingData, _testingGroundTruth,
+                                                        Parameters, configurations, numOfJobs, numOfThreads, TopK);
+    double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printSweepResults(results, _trainingData->getDimensionSize(0), Parameters.numberOfEpochs);
+    printf("Sweep finished in %.3f s, peak resident memory %.1f MB\n", time, getPeakResidentBytes() / (1024.0 * 1024.0));
+    TensorPool::getInstance().print();
+}
+
 /*LeNet training*/
-void train()
+template<typename FPType>
+void train(DatasetReader_MNIST<FPType> &reader)
 {
-    const size_t _batchSize = 10;
-    double learningRate = 0.01;
+    if (!StreamingTraining && !CompactTrainData && Processes.getSize() == 1)
+    {
+        _predictionModel = trainModel<FPType>(_trainingData, _trainingGroundTruth, Parameters);
+        return;
+    }
+
+    /* A replica reads only the objects of its own shard, memory does not grow with the number of processes */
+    ShardRange range = { 0, TrainDataCount };
+    if (Processes.getSize() > 1)
+    {
+        range = getShardRange(Processes, TrainDataCount, Parameters.batchSize);
+    }
+    SharedPtr<DatasetChunkReader<FPType> > trainData = readTrainData<FPType>(reader, range);
 
-    SharedPtr<optimization_solver::sgd::Batch<float> > sgdAlgorithm(new optimization_solver::sgd::Batch<float>());
-    (*(HomogenNumericTable<double>::cast(sgdAlgorithm->parameter.learningRateSequence)))[0][0] = learningRate;
+    if (Processes.getSize() > 1)
+    {
+        trainReplicas<FPType>(reader, *trainData);
+    }
+    else
+    {
+        _predictionModel = trainModelStreaming<FPType>(*trainData, Parameters);
+    }
+}
 
-    training::TopologyPtr topology = configureNet();
+/*Train objects of a range as the training mode keeps them: mapped, raw or expanded into tensors*/
+template<typename FPType>
+SharedPtr<DatasetChunkReader<FPType> > readTrainData(DatasetReader_MNIST<FPType> &reader, const ShardRange &range)
+{
+    if (CompactTrainData)
+    {
+        return reader.readCompactBatch(datasetFileNames[0], datasetFileNames[1], range.numOfObjects, range.firstObject);
+    }
 
-    training::Batch<> net;
+    SharedPtr<DatasetChunkReader_MNIST<FPType> > files(new DatasetChunkReader_MNIST<FPType>());
+    files->open(datasetFileNames[0], datasetFileNames[1], TrainDataCount);
+    if (!StreamingTraining)
+    {
+        SharedPtr<TensorChunk<FPType> > objects = readProbe<FPType>(*files, range.numOfObjects, range.firstObject);
+        return SharedPtr<DatasetChunkReader<FPType> >(new TensorDataset<FPType>(objects->data, objects->groundTruth));
+    }
+    if (range.firstObject == 0 && range.numOfObjects == files->getNumberOfObjects())
+    {
+        return files;
+    }
+    /* Every rank maps the files, the pages of its shard are the only ones it reads */
+    return SharedPtr<DatasetChunkReader<FPType> >(new DatasetShard<FPType>(
+        SharedPtr<DatasetChunkReader<FPType> >(files), range.firstObject, range.numOfObjects));
+}
 
-    net.parameter.batchSize = _batchSize;
-    net.parameter.optimizationSolver = sgdAlgorithm;
+/*Data-parallel LeNet training, rank 0 gets the averaged model and reports the scaling*/
+template<typename FPType>
+void trainReplicas(DatasetReader_MNIST<FPType> &reader, DatasetChunkReader<FPType> &trainData)
+{
+    DataParallelStatistics statistics;
+    _predictionModel = trainDataParallel<FPType>(Processes, trainData, Parameters, SyncInterval, &statistics);
 
-    net.initialize(_trainingData->getDimensions(), *topology);
+    if (Processes.getRank() > 0)
+    {
+        return;
+    }
+    if (!Processes.wait())
+    {
+        throw std::runtime_error("A worker process failed");
+    }
 
-    net.input.set(training::data, _trainingData);
-    net.input.set(training::groundTruth, _trainingGroundTruth);
-    net.compute();
+    double parallelRate = statistics.numOfImages / statistics.time;
+    printf("Data-parallel training: %lu processes, %.3f s, %.0f images/s, weights averaged %lu times in %.3f s (%.1f%%)\n",
+           (unsigned long)statistics.numOfProcesses, statistics.time, parallelRate, (unsigned long)statistics.numOfSyncs,
+           statistics.syncTime, 100.0 * statistics.syncTime / statistics.time);
 
-    _predictionModel = net.getResult()->get(training::model)->getPredictionModel<double>();
+    if (ScalingBaseline)
+    {
+        Environment::getInstance()->setNumberOfThreads(std::thread::hardware_concurrency());
+
+        TrainingParameters baselineParameters = Parameters;
+        baselineParameters.verbose = false;
+        std::vector<EpochStatistics> epochs;
+
+        /* The workers have exited, rank 0 reads the whole train set for one process */
+        ShardRange all = { 0, TrainDataCount };
+        SharedPtr<DatasetChunkReader<FPType> > baselineData = readTrainData<FPType>(reader, all);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        trainModelStreaming<FPType>(*baselineData, baselineParameters, &epochs);
+        double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        size_t numOfImages = baselineData->getNumberOfObjects();
+        numOfImages = (numOfImages - numOfImages % Parameters.batchSize) * epochs.size();
+        double baselineRate = numOfImages / time;
+        printf("Single process: %.3f s, %.0f images/s, speedup %.2f, scaling efficiency %.1f%%\n",
+               time, baselineRate, parallelRate / baselineRate,
+               100.0 * parallelRate / (baselineRate * statistics.numOfProcesses));
+    }
+}
+
+/*Save the trained model with the shape of the objects it expects*/
+template<typename FPType>
+void saveModel(DatasetReader_MNIST<FPType> &reader)
+{
+    Collection<size_t> objectDims;
+    objectDims.push_back(reader.numberOfChannels);
+    objectDims.push_back(reader.objectHeight);
+    objectDims.push_back(reader.objectWidth);
+
+    ModelFile<FPType>(ModelPath).save(_predictionModel, objectDims, Parameters.batchSize);
+    printf("Model saved to %s \n", ModelPath.c_str());
 }
 
 /*LeNet testing*/
+template<typename FPType>
 void test()
 {
-    prediction::Batch<> net;
+    if (StreamingTest)
+    {
+        testStreaming<FPType>();
+        return;
+    }
 
-    net.input.set(prediction::model, _predictionModel);
-    net.input.set(prediction::data, _testingData);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    _predictionResult = predict<FPType>(_predictionModel, _testingData);
+    double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-    net.compute();
+    if (Profiler::getInstance().isEnabled())
+    {
+        profileLayers<FPType>("prediction", getTopologyConfig(Parameters).getLayerNames(), _predictionModel->getLayers(),
+                              SharedPtr<BackwardLayers>());
+    }
+
+    if (PrintClasses)
+    {
+        printPredictedClasses<FPType>(_predictionResult, _testingGroundTruth);
+    }
 
-    _predictionResult = net.getResult();
+    _evaluation = evaluate<FPType>(_predictionResult, _testingGroundTruth, TopK);
+    _evaluation.print();
 
-    printPredictedClasses(_predictionResult, _testingGroundTruth);
+    if (Quantize)
+    {
+        testQuantized<FPType>(time);
+    }
 }
 
-/*check prediction results*/
-bool checkResult()
+/*LeNet testing on chunks of the test files, memory does not depend on the number of test objects*/
+template<typename FPType>
+void testStreaming()
 {
-    TensorPtr prediction = _predictionResult->get(prediction::prediction);
-    const Collection<size_t> &predictionDimensions = prediction->getDimensions();
+    DatasetChunkReader_MNIST<FPType> testReader;
+    testReader.open(datasetFileNames[2], datasetFileNames[3], TestDataCount);
 
-    SubtensorDescriptor<double> predictionBlock;
-    prediction->getSubtensor(0, 0, 0, predictionDimensions[0], readOnly, predictionBlock);
-    double *predictionPtr = predictionBlock.getPtr();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    _evaluation = predictStreaming<FPType>(_predictionModel, testReader, TestChunkSize, Parameters.prefetchBuffers, TopK);
+    double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-    SubtensorDescriptor<int> testGroundTruthBlock;
-    _testingGroundTruth->getSubtensor(0, 0, 0, predictionDimensions[0], readOnly, testGroundTruthBlock);
-    int *testGroundTruthPtr = testGroundTruthBlock.getPtr();
-    size_t maxPIndex = 0;
-    size_t trueCount = 0;
+    printf("Streaming prediction: %lu objects in chunks of %lu, %.3f s, %.0f images/s, peak resident memory %.1f MB\n",
+           (unsigned long)_evaluation.getNumberOfObjects(), (unsigned long)TestChunkSize, time,
+           _evaluation.getNumberOfObjects() / time, getPeakResidentBytes() / (1024.0 * 1024.0));
 
-    /*validation accuracy finding*/
-    for (size_t i = 0; i < predictionDimensions[0]; i++)
+    if (Profiler::getInstance().isEnabled())
     {
-        double maxP = 0;
-        maxPIndex = 0;
-        for (size_t j = 0; j < predictionDimensions[1]; j++)
-        {
-            double p = predictionPtr[i * predictionDimensions[1] + j];
-            if (maxP < p)
-            {
-                maxP = p;
-                maxPIndex = j;
-            }
-        }
-        if ( maxPIndex == testGroundTruthPtr[i] )
-        trueCount ++;
+        profileLayers<FPType>("prediction", getTopologyConfig(Parameters).getLayerNames(), _predictionModel->getLayers(),
+                              SharedPtr<BackwardLayers>());
     }
 
-    prediction->releaseSubtensor(predictionBlock);
-    _testingGroundTruth->releaseSubtensor(testGroundTruthBlock);
+    _evaluation.print();
 
-    if ( (double)trueCount / (double)TestDataCount > 0.9 )
+    if (Quantize)
     {
-        return true;
+        testQuantized<FPType>(time);
+    }
+}
+
+/*int8 LeNet testing*/
+template<typename FPType>
+void testQuantized(double referenceTime)
+{
+    DatasetChunkReader_MNIST<FPType> calibrationReader;
+    calibrationReader.open(datasetFileNames[0], datasetFileNames[1], CalibrationCount);
+    SharedPtr<TensorChunk<FPType> > calibrationSet = readProbe(calibrationReader, CalibrationCount);
+    if (!calibrationSet)
+    {
+        throw std::runtime_error("Quantization needs calibration objects");
+    }
+
+    QuantizedLeNet<FPType> quantizedNet(_predictionModel, calibrationSet->getData(calibrationSet->numOfObjects));
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (StreamingTest)
+    {
+        DatasetChunkReader_MNIST<FPType> testReader;
+        testReader.open(datasetFileNames[2], datasetFileNames[3], TestDataCount);
+        QuantizedPredictor<FPType> predictor(quantizedNet);
+        _quantizedEvaluation = evaluateChunks<FPType>(testReader, TestChunkSize, Parameters.prefetchBuffers, TopK, predictor);
     }
     else
     {
-        return false;
+        _quantizedEvaluation = evaluate<FPType>(predictQuantized(quantizedNet, _testingData), _testingGroundTruth, TopK);
     }
+    double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t weightsSize = quantizedNet.getWeightsSize();
+    printf("int8 model calibrated on %lu objects: weights %.1f KB instead of %.1f KB, prediction %.2f ms instead of %.2f ms\n",
+           (unsigned long)calibrationSet->numOfObjects, weightsSize / 1024.0, weightsSize * sizeof(FPType) / 1024.0,
+           1000.0 * time, 1000.0 * referenceTime);
+}
+
+/*check prediction results*/
+template<typename FPType>
+bool checkResult()
+{
+    double accuracy = _evaluation.getAccuracy();
+    if (_quantizedEvaluation.getNumberOfObjects() == 0)
+    {
+        return accuracy > MinAccuracy;
+    }
+
+    double quantizedAccuracy = _quantizedEvaluation.getAccuracy();
+    printf("Accuracy %.4f, int8 accuracy %.4f, delta %+.4f (allowed loss %.4f)\n",
+           accuracy, quantizedAccuracy, quantizedAccuracy - accuracy, MaxAccuracyLoss);
+    return accuracy > MinAccuracy && accuracy - quantizedAccuracy <= MaxAccuracyLoss;
 }
@@ -0,0 +1,336 @@
+/* file: data_parallel.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Data-parallel LeNet training in several local processes with periodic weights averaging
+!******************************************************************************/
+
+#ifndef _DATA_PARALLEL_H
+#define _DATA_PARALLEL_H
+
+#include "lenet_pipeline.h"
+#include <vector>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+/* Processes of one machine connected to rank 0 by Unix sockets.
+   Rank 0 is the process that spawns the group, it reduces the values of all ranks */
+class ProcessGroup
+{
+public:
+
+    ProcessGroup() : _rank(0), _size(1) { }
+
+    ~ProcessGroup()
+    {
+        for (size_t i = 0; i < _peers.size(); i++)
+        {
+            close(_peers[i]);
+        }
+    }
+
+    /* Forks size - 1 workers that continue from this call with their own rank.
+       Must be called before any threads are started: a forked child has only the calling thread,
+       so thread pools of the parent would be unusable in it. Returns the rank of the calling process */
+    size_t spawn(size_t size)
+    {
+        fflush(stdout);
+        fflush(stderr);
+
+        for (size_t rank = 1; rank < size; rank++)
+        {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+            {
+                throw std::runtime_error("Unable to create a socket pair");
+            }
+
+            pid_t pid = fork();
+            if (pid < 0)
+            {
+                throw std::runtime_error("Unable to start a worker process");
+            }
+
+            if (pid == 0)
+            {
+                for (size_t i = 0; i < _peers.size(); i++)
+                {
+                    close(_peers[i]);
+                }
+                close(fds[0]);
+                _peers.assign(1, fds[1]);
+                _workers.clear();
+                _rank = rank;
+                _size = size;
+                return _rank;
+            }
+
+            close(fds[1]);
+            _peers.push_back(fds[0]);
+            _workers.push_back(pid);
+        }
+
+        _size = size;
+        return _rank;
+    }
+
+    /* Waits for all workers to exit, returns false if any of them failed */
+    bool wait()
+    {
+        bool succeeded = true;
+        for (size_t i = 0; i < _workers.size(); i++)
+        {
+            int status = 0;
+            while (waitpid(_workers[i], &status, 0) < 0 && errno == EINTR) { }
+            succeeded = succeeded && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+        _workers.clear();
+        return succeeded;
+    }
+
+    /* Replaces the values on every rank with their element-wise mean over the group.
+       All ranks must call it in the same order with the same number of values */
+    template<typename FPType>
+    void average(FPType *values, size_t n)
+    {
+        if (_size == 1) { return; }
+
+        if (_rank == 0)
+        {
+            _buffer.resize(n * sizeof(FPType));
+            FPType *received = (FPType *)&_buffer[0];
+            for (size_t i = 0; i < _peers.size(); i++)
+            {
+                receive(_peers[i], received, n);
+                for (size_t j = 0; j < n; j++)
+                {
+                    values[j] += received[j];
+                }
+            }
+
+            const FPType scale = (FPType)1 / (FPType)_size;
+            for (size_t j = 0; j < n; j++)
+            {
+                values[j] *= scale;
+            }
+
+            for (size_t i = 0; i < _peers.size(); i++)
+            {
+                send(_peers[i], values, n);
+            }
+        }
+        else
+        {
+            send(_peers[0], values, n);
+            receive(_peers[0], values, n);
+        }
+    }
+
+    inline size_t getRank() { return _rank; }
+    inline size_t getSize() { return _size; }
+
+private:
+
+    /* Every message is prefixed with its number of values, so that ranks out of step fail loudly */
+    template<typename FPType>
+    static void send(int fd, const FPType *values, size_t n)
+    {
+        uint64_t count = n;
+        write(fd, &count, sizeof(count));
+        write(fd, values, n * sizeof(FPType));
+    }
+
+    template<typename FPType>
+    static void receive(int fd, FPType *values, size_t n)
+    {
+        uint64_t count = 0;
+        read(fd, &count, sizeof(count));
+        if (count != n)
+        {
+            throw std::runtime_error("Processes of the group are out of step");
+        }
+        read(fd, values, n * sizeof(FPType));
+    }
+
+    static void write(int fd, const void *ptr, size_t size)
+    {
+        const char *bytes = (const char *)ptr;
+        while (size > 0)
+        {
+            ssize_t written = ::write(fd, bytes, size);
+            if (written < 0 && errno == EINTR) { continue; }
+            if (written <= 0)
+            {
+                throw std::runtime_error("Connection to a process of the group is lost");
+            }
+            bytes += written;
+            size -= (size_t)written;
+        }
+    }
+
+    static void read(int fd, void *ptr, size_t size)
+    {
+        char *bytes = (char *)ptr;
+        while (size > 0)
+        {
+            ssize_t received = ::read(fd, bytes, size);
+            if (received < 0 && errno == EINTR) { continue; }
+            if (received <= 0)
+            {
+                throw std::runtime_error("Connection to a process of the group is lost");
+            }
+            bytes += received;
+            size -= (size_t)received;
+        }
+    }
+
+    ProcessGroup(const ProcessGroup &);
+    ProcessGroup &operator=(const ProcessGroup &);
+
+    size_t _rank;
+    size_t _size;
+    std::vector<int> _peers;
+    std::vector<pid_t> _workers;
+    std::vector<char> _buffer;
+};
+
+/* Averages the weights of the replicas every syncInterval chunks and at the end of every epoch.
+   The replicas start from the same weights because the layer initializers are seeded identically */
+template<typename FPType>
+class WeightsAverager : public TrainingListener
+{
+public:
+
+    WeightsAverager(ProcessGroup &group, size_t syncInterval) :
+        _group(group), _syncInterval(syncInterval), _synchronized(false), _numOfSyncs(0), _syncTime(0) { }
+
+    virtual void chunkTrained(const training::ModelPtr &model, size_t /* epoch */, size_t chunk)
+    {
+        _synchronized = _syncInterval > 0 && (chunk + 1) % _syncInterval == 0;
+        if (_synchronized)
+        {
+            average(model);
+        }
+    }
+
+    virtual void epochTrained(const training::ModelPtr &model, size_t /* epoch */)
+    {
+        if (!_synchronized)
+        {
+            average(model);
+        }
+        _synchronized = false;
+    }
+
+    inline size_t getNumberOfSyncs() { return _numOfSyncs; }
+    /* Seconds spent exchanging weights, including waiting for slower replicas */
+    inline double getSyncTime() { return _syncTime; }
+
+private:
+
+    void average(const training::ModelPtr &model)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        NumericTablePtr weights = model->getWeightsAndBiases();
+        BlockDescriptor<FPType> block;
+        weights->getBlockOfRows(0, weights->getNumberOfRows(), readWrite, block);
+        _group.average(block.getBlockPtr(), block.getNumberOfRows() * block.getNumberOfColumns());
+        weights->releaseBlockOfRows(block);
+        model->setWeightsAndBiases(weights);
+
+        _numOfSyncs++;
+        _syncTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    ProcessGroup &_group;
+    size_t _syncInterval;
+    bool _synchronized;
+    size_t _numOfSyncs;
+    double _syncTime;
+};
+
+struct DataParallelStatistics
+{
+    size_t numOfProcesses;
+    size_t numOfImages;
+    double time;
+    double syncTime;
+    size_t numOfSyncs;
+};
+
+/* Objects of the dataset one rank trains on */
+struct ShardRange
+{
+    size_t firstObject;
+    size_t numOfObjects;
+};
+
+/* Shards are equal and hold whole minibatches, so that all ranks reach every weights exchange together.
+   A rank only needs to load the objects of its own range */
+inline ShardRange getShardRange(ProcessGroup &group, size_t numOfObjects, size_t batchSize)
+{
+    size_t shardSize = numOfObjects / group.getSize();
+    shardSize -= shardSize % batchSize;
+    if (shardSize == 0)
+    {
+        throw std::runtime_error("Train set is too small for the number of processes");
+    }
+
+    ShardRange range = { group.getRank() * shardSize, shardSize };
+    return range;
+}
+
+/* Trains this rank's replica on its shard of the dataset, the range of getShardRange.
+   Only rank 0 prints the epoch statistics */
+template<typename FPType>
+prediction::ModelPtr trainDataParallel(ProcessGroup &group, DatasetChunkReader<FPType> &shard,
+                                       const TrainingParameters &parameters, size_t syncInterval,
+                                       DataParallelStatistics *statistics = NULL)
+{
+    const size_t shardSize = shard.getNumberOfObjects();
+    if (shardSize == 0 || shardSize % parameters.batchSize != 0)
+    {
+        throw std::runtime_error("Shard of the train set must hold whole minibatches");
+    }
+
+    TrainingParameters shardParameters = parameters;
+    shardParameters.verbose = parameters.verbose && group.getRank() == 0;
+    /* Rank 0 writes the checkpoints, all ranks resume from them */
+    if (group.getRank() > 0)
+    {
+        shardParameters.checkpointInterval = 0;
+    }
+
+    WeightsAverager<FPType> averager(group, syncInterval);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<EpochStatistics> epochs;
+    prediction::ModelPtr model = trainModelStreaming<FPType>(shard, shardParameters, &epochs, &averager);
+
+    if (statistics)
+    {
+        statistics->numOfProcesses = group.getSize();
+        statistics->numOfImages = shardSize * group.getSize() * epochs.size();
+        statistics->time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        statistics->syncTime = averager.getSyncTime();
+        statistics->numOfSyncs = averager.getNumberOfSyncs();
+    }
+    return model;
+}
+
+#endif
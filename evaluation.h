@@ -0,0 +1,279 @@
+/* file: evaluation.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Accuracy, top-k accuracy, loss, confusion matrix and per-class precision and recall
+!    of class probabilities in one parallel pass
+!******************************************************************************/
+
+#ifndef _EVALUATION_H
+#define _EVALUATION_H
+
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
+#include "daal.h"
+#include "simd.h"
+
+using namespace daal;
+using namespace daal::algorithms;
+using namespace daal::algorithms::neural_networks;
+using namespace daal::services;
+using namespace daal::data_management;
+
+/* Counts of one evaluation, partial results of row blocks are merged into it */
+class Evaluation
+{
+public:
+
+    Evaluation(size_t nClasses = 0, size_t maxK = 1) :
+        _nClasses(nClasses), _maxK(std::max<size_t>(maxK, 1)), _numOfObjects(0), _loss(0),
+        _confusion(nClasses * nClasses, 0), _rankCounts(std::max<size_t>(maxK, 1), 0) { }
+
+    /* One object whose most probable class is predicted and whose true class has rank
+       classes with a strictly higher probability, a rank of maxK or more is a miss */
+    inline void add(size_t actual, size_t predicted, size_t rank, double loss)
+    {
+        if (actual >= _nClasses || predicted >= _nClasses)
+        {
+            throw std::runtime_error("Evaluated class is outside of the predicted classes");
+        }
+        _numOfObjects++;
+        _confusion[actual * _nClasses + predicted]++;
+        if (rank < _maxK)
+        {
+            _rankCounts[rank]++;
+        }
+        _loss += loss;
+    }
+
+    void merge(const Evaluation &other)
+    {
+        _numOfObjects += other._numOfObjects;
+        _loss += other._loss;
+        for (size_t i = 0; i < _confusion.size(); i++)
+        {
+            _confusion[i] += other._confusion[i];
+        }
+        for (size_t i = 0; i < _rankCounts.size(); i++)
+        {
+            _rankCounts[i] += other._rankCounts[i];
+        }
+    }
+
+    inline size_t getNumberOfObjects() const { return _numOfObjects; }
+    inline size_t getNumberOfClasses() const { return _nClasses; }
+    inline size_t getMaxK() const { return _maxK; }
+
+    /* Share of objects whose most probable class is the true one, ties go to the lower class index */
+    double getAccuracy() const
+    {
+        size_t correct = 0;
+        for (size_t c = 0; c < _nClasses; c++)
+        {
+            correct += _confusion[c * _nClasses + c];
+        }
+        return _numOfObjects ? (double)correct / _numOfObjects : 0.0;
+    }
+
+    /* Share of objects whose true class is among the k most probable ones, k <= maxK */
+    double getTopKAccuracy(size_t k) const
+    {
+        if (k <= 1) { return getAccuracy(); }
+        size_t correct = 0;
+        for (size_t r = 0; r < k && r < _rankCounts.size(); r++)
+        {
+            correct += _rankCounts[r];
+        }
+        return _numOfObjects ? (double)correct / _numOfObjects : 0.0;
+    }
+
+    /* Mean cross-entropy of the true class probabilities */
+    inline double getLoss() const { return _numOfObjects ? _loss / _numOfObjects : 0.0; }
+
+    inline size_t getConfusion(size_t actual, size_t predicted) const { return _confusion[actual * _nClasses + predicted]; }
+
+    /* Share of the objects predicted as the class that belong to it */
+    double getPrecision(size_t c) const
+    {
+        size_t predicted = 0;
+        for (size_t a = 0; a < _nClasses; a++)
+        {
+            predicted += _confusion[a * _nClasses + c];
+        }
+        return predicted ? (double)_confusion[c * _nClasses + c] / predicted : 0.0;
+    }
+
+    /* Share of the objects of the class that are predicted as it */
+    double getRecall(size_t c) const
+    {
+        size_t actual = 0;
+        for (size_t p = 0; p < _nClasses; p++)
+        {
+            actual += _confusion[c * _nClasses + p];
+        }
+        return actual ? (double)_confusion[c * _nClasses + c] / actual : 0.0;
+    }
+
+    void print() const
+    {
+        printf("Evaluated %lu objects: accuracy %.4f", (unsigned long)_numOfObjects, getAccuracy());
+        for (size_t k = 2; k <= _maxK; k++)
+        {
+            printf(", top-%lu %.4f", (unsigned long)k, getTopKAccuracy(k));
+        }
+        printf(", loss %.4f\n", getLoss());
+
+        printf("class precision  recall   objects\n");
+        for (size_t c = 0; c < _nClasses; c++)
+        {
+            size_t actual = 0;
+            for (size_t p = 0; p < _nClasses; p++)
+            {
+                actual += _confusion[c * _nClasses + p];
+            }
+            printf("%5lu %9.4f %7.4f %9lu\n", (unsigned long)c, getPrecision(c), getRecall(c), (unsigned long)actual);
+        }
+
+        printf("Confusion matrix, rows are true classes, columns predicted classes\n");
+        for (size_t a = 0; a < _nClasses; a++)
+        {
+            for (size_t p = 0; p < _nClasses; p++)
+            {
+                printf("%6lu", (unsigned long)_confusion[a * _nClasses + p]);
+            }
+            printf("\n");
+        }
+    }
+
+private:
+
+    size_t _nClasses;
+    size_t _maxK;
+    size_t _numOfObjects;
+    double _loss;
+    std::vector<size_t> _confusion;
+    /* Objects whose true class has the given rank */
+    std::vector<size_t> _rankCounts;
+};
+
+/* Most probable class of a row and the rank of a class in it, SSE2 over the classes */
+template<typename FPType>
+struct RowReduction
+{
+    typedef Simd<FPType> S;
+    typedef typename S::Vector Vector;
+
+    /* Index of the largest probability, ties go to the lower index and NaN is never larger,
+       so a row of NaN predicts class 0 */
+    static inline size_t argMax(const FPType *row, size_t n)
+    {
+        size_t best = 0;
+        for (size_t j = 1; j < n; j++)
+        {
+            if (row[j] > row[best] || (std::isnan(row[best]) && !std::isnan(row[j])))
+            {
+                best = j;
+            }
+        }
+        return best;
+    }
+
+    /* Number of probabilities above the one of the class, n if it is NaN and has no rank */
+    static inline size_t rank(const FPType *row, size_t n, size_t c)
+    {
+        const FPType threshold = row[c];
+        if (std::isnan(threshold))
+        {
+            return n;
+        }
+
+        size_t count = 0, j = 0;
+        const Vector t = S::set1(threshold);
+        for (; j + S::width <= n; j += S::width)
+        {
+            count += popcount(S::greater(S::load(row + j), t));
+        }
+        for (; j < n; j++)
+        {
+            count += row[j] > threshold;
+        }
+        return count;
+    }
+
+    static inline size_t popcount(int mask)
+    {
+        size_t count = 0;
+        for (; mask; mask &= mask - 1)
+        {
+            count++;
+        }
+        return count;
+    }
+};
+
+/* Rows of the prediction tensor are split into blocks evaluated by TBB workers and merged */
+template<typename FPType>
+Evaluation evaluate(const prediction::ResultPtr &predictionResult, const TensorPtr &groundTruth, size_t maxK = 5)
+{
+    TensorPtr prediction = predictionResult->get(prediction::prediction);
+    const size_t n = prediction->getDimensionSize(0);
+    const size_t nClasses = prediction->getDimensionSize(1);
+    maxK = std::min(std::max<size_t>(maxK, 1), nClasses);
+
+    SubtensorDescriptor<FPType> predictionBlock;
+    prediction->getSubtensor(0, 0, 0, n, readOnly, predictionBlock);
+    const FPType *probabilities = predictionBlock.getPtr();
+
+    SubtensorDescriptor<int> groundTruthBlock;
+    groundTruth->getSubtensor(0, 0, 0, n, readOnly, groundTruthBlock);
+    const int *labels = groundTruthBlock.getPtr();
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (labels[i] < 0 || (size_t)labels[i] >= nClasses)
+        {
+            prediction->releaseSubtensor(predictionBlock);
+            groundTruth->releaseSubtensor(groundTruthBlock);
+            throw std::runtime_error("Ground truth has a label outside of the predicted classes");
+        }
+    }
+
+    const double minProbability = 1e-12;
+    Evaluation evaluation = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, n, 1024), Evaluation(nClasses, maxK),
+        [&](const tbb::blocked_range<size_t> &range, Evaluation partial) -> Evaluation
+        {
+            for (size_t i = range.begin(); i < range.end(); i++)
+            {
+                const FPType *row = probabilities + i * nClasses;
+                const FPType p = row[labels[i]];
+                partial.add(labels[i], RowReduction<FPType>::argMax(row, nClasses),
+                            RowReduction<FPType>::rank(row, nClasses, labels[i]),
+                            -std::log(std::max((double)p, minProbability)));
+            }
+            return partial;
+        },
+        [](Evaluation a, const Evaluation &b) -> Evaluation
+        {
+            a.merge(b);
+            return a;
+        });
+
+    prediction->releaseSubtensor(predictionBlock);
+    groundTruth->releaseSubtensor(groundTruthBlock);
+
+    return evaluation;
+}
+
+#endif
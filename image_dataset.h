@@ -7,11 +7,25 @@
 //    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
 */
 
+#ifndef _IMAGE_DATASET_H
+#define _IMAGE_DATASET_H
+
 #include <vector>
+#include <algorithm>
+#include <cstring>
 #include <cstdint>
 #include <fstream>
 #include <stdexcept>
+#include <emmintrin.h>
 #include "daal.h"
+#include "tbb/parallel_for.h"
+#include "tbb/blocked_range.h"
+#include "mapped_file.h"
+#include "tensor_cache.h"
+#include "instrumentation.h"
+#include "threading.h"
+#include "tensor_pool.h"
+#include <typeinfo>
 
 using namespace daal;
 using namespace daal::services;
@@ -49,8 +63,108 @@ public:
 };
 
 
+/* SSE2 conversion of uint8 pixels, optionally divided by 255 exactly as RGBChannelNormalizer does */
+template<bool scale>
+inline void convertPixels(const uint8_t *src, float *dst, size_t size)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 divisor = _mm_set1_ps(255.0f);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i words[2] = { _mm_unpacklo_epi8(bytes, zero), _mm_unpackhi_epi8(bytes, zero) };
+        for (size_t j = 0; j < 2; j++)
+        {
+            __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words[j], zero));
+            __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words[j], zero));
+            if (scale)
+            {
+                lo = _mm_div_ps(lo, divisor);
+                hi = _mm_div_ps(hi, divisor);
+            }
+            _mm_storeu_ps(dst + i + 8 * j, lo);
+            _mm_storeu_ps(dst + i + 8 * j + 4, hi);
+        }
+    }
+    for (; i < size; i++)
+    {
+        dst[i] = scale ? (float)src[i] / 255.0f : (float)src[i];
+    }
+}
+
+template<bool scale>
+inline void convertPixels(const uint8_t *src, double *dst, size_t size)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128d divisor = _mm_set1_pd(255.0);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i words[2] = { _mm_unpacklo_epi8(bytes, zero), _mm_unpackhi_epi8(bytes, zero) };
+        for (size_t j = 0; j < 2; j++)
+        {
+            __m128i dwords[2] = { _mm_unpacklo_epi16(words[j], zero), _mm_unpackhi_epi16(words[j], zero) };
+            for (size_t k = 0; k < 2; k++)
+            {
+                __m128d lo = _mm_cvtepi32_pd(dwords[k]);
+                __m128d hi = _mm_cvtepi32_pd(_mm_srli_si128(dwords[k], 8));
+                if (scale)
+                {
+                    lo = _mm_div_pd(lo, divisor);
+                    hi = _mm_div_pd(hi, divisor);
+                }
+                _mm_storeu_pd(dst + i + 8 * j + 4 * k, lo);
+                _mm_storeu_pd(dst + i + 8 * j + 4 * k + 2, hi);
+            }
+        }
+    }
+    for (; i < size; i++)
+    {
+        dst[i] = scale ? (double)src[i] / 255.0 : (double)src[i];
+    }
+}
+
+/* Applies a normalizer to a row of pixels. Arbitrary normalizers are called per pixel,
+   the ones shipped with the readers are specialized to the vectorized conversion */
+template<typename FPType, typename Normalizer>
+struct NormalizationKernel
+{
+    static inline void apply(Normalizer &normalizer, const uint8_t *src, FPType *dst, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            dst[i] = normalizer((FPType)src[i]);
+        }
+    }
+};
+
+template<typename FPType>
+struct NormalizationKernel<FPType, RGBChannelNormalizer<FPType> >
+{
+    static inline void apply(RGBChannelNormalizer<FPType> &, const uint8_t *src, FPType *dst, size_t size)
+    {
+        convertPixels<true>(src, dst, size);
+    }
+};
+
+template<typename FPType>
+struct NormalizationKernel<FPType, DummyNormalizer<FPType> >
+{
+    static inline void apply(DummyNormalizer<FPType> &, const uint8_t *src, FPType *dst, size_t size)
+    {
+        convertPixels<false>(src, dst, size);
+    }
+};
+
+
+/* Images of 8-bit planar channels decoded and normalized into NCHW tensors, with zero margins
+   around every plane. Readers of the formats supply the pixels of every object */
 template<typename FPType, typename Normalizer = RGBChannelNormalizer<FPType> >
-class ImageDatasetReader
+class ImageDatasetReader : public DatasetReader
 {
 public:
     size_t numberOfChannels;
@@ -74,12 +188,18 @@ public:
     virtual SharedPtr<Tensor> getTestData() { return _testData; }
     virtual SharedPtr<Tensor> getTestGroundTruth() { return _testGroundTruth; }
 
+    /* NUMA placement of the pages of the train and test tensors */
+    inline void setMemoryPlacement(MemoryPlacement placement) { _placement = placement; }
+
 protected:
 
+    MemoryPlacement _placement;
+
     ImageDatasetReader(size_t channelsNum, size_t height, size_t width) :
         numberOfChannels(channelsNum),
         objectHeight(height),
-        objectWidth(width) { }
+        objectWidth(width),
+        _placement(placementDefault) { }
 
     virtual void allocateTensors()
     {
@@ -88,35 +208,41 @@ protected:
 
         if (numberOfObjects > 0)
         {
-            Collection<size_t> trainDataDims;
-            trainDataDims.push_back(numberOfObjects);
-            trainDataDims.push_back(numberOfChannels);
-            trainDataDims.push_back(objectHeight);
-            trainDataDims.push_back(objectWidth);
-            _trainData = SharedPtr<HomogenTensor<FPType> >(
-                             new HomogenTensor<FPType>(trainDataDims, Tensor::doAllocate, (FPType)0));
-
-            Collection<size_t> trainGroundTruthDims;
-            trainGroundTruthDims.push_back(numberOfObjects);
-            _trainGroundTruth = SharedPtr<HomogenTensor<FPType> >(
-                                    new HomogenTensor<FPType>(trainGroundTruthDims, Tensor::doAllocate));
+            allocateTensors(numberOfObjects, _trainData, _trainGroundTruth);
         }
 
         if (numberOfTestObjects > 0)
         {
-            Collection<size_t> testDataDims;
-            testDataDims.push_back(numberOfTestObjects);
-            testDataDims.push_back(numberOfChannels);
-            testDataDims.push_back(objectHeight);
-            testDataDims.push_back(objectWidth);
-            _testData = SharedPtr<HomogenTensor<FPType> >(
-                            new HomogenTensor<FPType>(testDataDims, Tensor::doAllocate, (FPType)0));
+            allocateTensors(numberOfTestObjects, _testData, _testGroundTruth);
+        }
+    }
+
+    virtual void allocateTensors(size_t numberOfObjects,
+                                 SharedPtr<HomogenTensor<FPType> > &data, SharedPtr<HomogenTensor<FPType> > &groundTruth)
+    {
+        /* Pages recycled from the pool keep the placement of their first use */
+        bool fresh = false;
+        data = makePooledTensor<FPType>(getDataDimensions(numberOfObjects), &fresh);
 
-            Collection<size_t> testGroundTruthDims;
-            testGroundTruthDims.push_back(numberOfTestObjects);
-            _testGroundTruth = SharedPtr<HomogenTensor<FPType> >(
-                                   new HomogenTensor<FPType>(testGroundTruthDims, Tensor::doAllocate));
+        Collection<size_t> groundTruthDims;
+        groundTruthDims.push_back(numberOfObjects);
+        groundTruth = makePooledTensor<FPType>(groundTruthDims);
+
+        if (fresh)
+        {
+            placeMemory(data->getArray(), data->getSize() * sizeof(FPType), _placement);
         }
+        Profiler::getInstance().addAllocation("dataset tensors", (data->getSize() + groundTruth->getSize()) * sizeof(FPType));
+    }
+
+    Collection<size_t> getDataDimensions(size_t numberOfObjects)
+    {
+        Collection<size_t> dataDims;
+        dataDims.push_back(numberOfObjects);
+        dataDims.push_back(numberOfChannels);
+        dataDims.push_back(objectHeight);
+        dataDims.push_back(objectWidth);
+        return dataDims;
     }
 
     virtual size_t getNumberOfTrainObjects() = 0;
@@ -124,9 +250,90 @@ protected:
 
     void normalizeBuffer(const uint8_t *buffer, FPType *normalized, size_t bufferSize)
     {
-        for (size_t i = 0; i < bufferSize; i++)
+        NormalizationKernel<FPType, Normalizer>::apply(_normalizer, buffer, normalized, bufferSize);
+    }
+
+    /* Normalizes planar objects of sourceHeight x sourceWidth pixels into consecutive objects of the tensor
+       from firstObject on, centering every plane and writing the zero margins around it. objectPixels(i) gives
+       the pixels of the i-th object, so that any layout of the source is decoded by the same loop.
+       Objects are split between TBB workers */
+    template<typename PixelLocator>
+    void decodeObjects(const PixelLocator &objectPixels, FPType *tensorData, size_t firstObject, size_t numOfObjects,
+                       size_t sourceHeight, size_t sourceWidth)
+    {
+        const size_t grainSize = 64;
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, numOfObjects, grainSize),
+                          [&](const tbb::blocked_range<size_t> &range)
+        {
+            Normalizer normalizer(_normalizer);
+            for (size_t i = range.begin(); i < range.end(); i++)
+            {
+                normalizeObject(normalizer, objectPixels(i), tensorData + tensorOffset(firstObject + i), sourceHeight, sourceWidth);
+            }
+        });
+    }
+
+    /* Objects stored one after another, pixelStride bytes apart, 0 if they are packed */
+    void normalizeObjects(const uint8_t *pixels, FPType *tensorData, size_t firstObject, size_t numOfObjects,
+                          size_t sourceHeight, size_t sourceWidth, size_t pixelStride = 0)
+    {
+        const size_t stride = pixelStride ? pixelStride : numberOfChannels * sourceHeight * sourceWidth;
+        decodeObjects([=](size_t i) { return pixels + i * stride; }, tensorData, firstObject, numOfObjects,
+                      sourceHeight, sourceWidth);
+    }
+
+    /* Same as above for the objects with the given indices, gathered into consecutive objects of the tensor */
+    void normalizeObjects(const uint8_t *pixels, const size_t *indices, FPType *tensorData, size_t numOfObjects,
+                          size_t sourceHeight, size_t sourceWidth, size_t pixelStride = 0)
+    {
+        const size_t stride = pixelStride ? pixelStride : numberOfChannels * sourceHeight * sourceWidth;
+        decodeObjects([=](size_t i) { return pixels + indices[i] * stride; }, tensorData, 0, numOfObjects,
+                      sourceHeight, sourceWidth);
+    }
+
+    /* Fills the train tensors with all objects of a dataset that is otherwise read in chunks */
+    template<typename ChunkReader>
+    void readTrainTensors(ChunkReader &reader)
+    {
+        allocateTensors();
+        const size_t position = reader.getPosition();
+        reader.seek(0);
+        if (_trainData)
         {
-            normalized[i] = _normalizer((FPType)buffer[i]);
+            reader.readChunk(_trainData->getArray(), _trainGroundTruth->getArray(), reader.getNumberOfObjects());
+        }
+        reader.seek(position);
+    }
+
+    void normalizeObject(Normalizer &normalizer, const uint8_t *pixels, FPType *objectData,
+                         size_t sourceHeight, size_t sourceWidth)
+    {
+        const size_t topMargin = (objectHeight - sourceHeight) / 2;
+        const size_t bottomMargin = objectHeight - sourceHeight - topMargin;
+        const size_t leftMargin = (objectWidth - sourceWidth) / 2;
+        const size_t rightMargin = objectWidth - sourceWidth - leftMargin;
+
+        for (size_t k = 0; k < numberOfChannels; k++)
+        {
+            const uint8_t *src = pixels + k * sourceHeight * sourceWidth;
+            FPType *dst = objectData + k * objectHeight * objectWidth;
+
+            if (leftMargin == 0 && rightMargin == 0 && topMargin == 0 && bottomMargin == 0)
+            {
+                NormalizationKernel<FPType, Normalizer>::apply(normalizer, src, dst, sourceHeight * sourceWidth);
+                continue;
+            }
+
+            std::fill(dst, dst + topMargin * objectWidth, (FPType)0);
+            dst += topMargin * objectWidth;
+            for (size_t h = 0; h < sourceHeight; h++)
+            {
+                std::fill(dst, dst + leftMargin, (FPType)0);
+                NormalizationKernel<FPType, Normalizer>::apply(normalizer, src + h * sourceWidth, dst + leftMargin, sourceWidth);
+                std::fill(dst + leftMargin + sourceWidth, dst + objectWidth, (FPType)0);
+                dst += objectWidth;
+            }
+            std::fill(dst, dst + bottomMargin * objectWidth, (FPType)0);
         }
     }
 
@@ -145,13 +352,310 @@ private:
 
 };
 
+/* Dataset that is read in consecutive chunks on demand instead of being loaded as a whole */
+template<typename FPType>
+class DatasetChunkReader
+{
+public:
+    DatasetChunkReader() { }
+    virtual ~DatasetChunkReader() { }
+
+    virtual size_t getNumberOfObjects() = 0;
+    /* Sizes of one object: channels, height, width */
+    virtual Collection<size_t> getObjectDimensions() = 0;
+
+    /* Index of the object the next chunk starts from */
+    virtual size_t getPosition() = 0;
+    virtual void seek(size_t objectIndex) = 0;
+    inline void rewind() { seek(0); }
+
+    /* Reads up to maxObjects following objects, returns the number of objects read */
+    virtual size_t readChunk(FPType *data, FPType *labels, size_t maxObjects) = 0;
+
+    /* Reads the objects with the given indices in that order, the position is not changed */
+    virtual void readObjects(const size_t *indices, size_t numOfObjects, FPType *data, FPType *labels) = 0;
+};
+
+/* Dataset already resident in tensors, chunks are copied out of them */
+template<typename FPType>
+class TensorDataset : public DatasetChunkReader<FPType>
+{
+private:
+
+    SharedPtr<HomogenTensor<FPType> > _data;
+    SharedPtr<HomogenTensor<FPType> > _groundTruth;
+    size_t _objectSize;
+    size_t _position;
+
+public:
+
+    TensorDataset(const SharedPtr<Tensor> &data, const SharedPtr<Tensor> &groundTruth) :
+        _data(staticPointerCast<HomogenTensor<FPType>, Tensor>(data)),
+        _groundTruth(staticPointerCast<HomogenTensor<FPType>, Tensor>(groundTruth)),
+        _objectSize(data->getSize() / data->getDimensionSize(0)), _position(0) { }
+
+    virtual ~TensorDataset() { }
+
+    virtual size_t getNumberOfObjects() { return _data->getDimensionSize(0); }
+
+    virtual Collection<size_t> getObjectDimensions()
+    {
+        Collection<size_t> dims;
+        for (size_t i = 1; i < _data->getNumberOfDimensions(); i++)
+        {
+            dims.push_back(_data->getDimensionSize(i));
+        }
+        return dims;
+    }
+
+    virtual size_t getPosition() { return _position; }
+    virtual void seek(size_t objectIndex) { _position = std::min(objectIndex, getNumberOfObjects()); }
+
+    virtual size_t readChunk(FPType *data, FPType *labels, size_t maxObjects)
+    {
+        size_t count = std::min(maxObjects, getNumberOfObjects() - _position);
+        memcpy(data, _data->getArray() + _position * _objectSize, count * _objectSize * sizeof(FPType));
+        memcpy(labels, _groundTruth->getArray() + _position, count * sizeof(FPType));
+        _position += count;
+        return count;
+    }
+
+    virtual void readObjects(const size_t *indices, size_t numOfObjects, FPType *data, FPType *labels)
+    {
+        const FPType *objects = _data->getArray();
+        const FPType *classNumbers = _groundTruth->getArray();
+        const size_t grainSize = 256;
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, numOfObjects, grainSize),
+                          [&](const tbb::blocked_range<size_t> &range)
+        {
+            for (size_t i = range.begin(); i < range.end(); i++)
+            {
+                memcpy(data + i * _objectSize, objects + indices[i] * _objectSize, _objectSize * sizeof(FPType));
+                labels[i] = classNumbers[indices[i]];
+            }
+        });
+    }
+};
+
+/* Dataset kept resident as raw uint8 pixels. Objects are normalized and padded only
+   when a chunk of them is read, so memory per pixel is one byte regardless of FPType */
 template<typename FPType, typename Normalizer = RGBChannelNormalizer<FPType> >
-class DatasetReader_MNIST : public ImageDatasetReader<FPType, Normalizer>
+class CompactDataset : public ImageDatasetReader<FPType, Normalizer>, public DatasetChunkReader<FPType>
 {
 private:
 
-    const int DATA_MAGIC_NUMBER = 0x00000803;
-    const int LABELS_MAGIC_NUMBER = 0x00000801;
+    SharedPtr<HomogenTensor<uint8_t> > _pixels;
+    SharedPtr<HomogenTensor<uint8_t> > _labels;
+    size_t _numOfObjects;
+    size_t _position;
+
+public:
+
+    size_t originalObjectHeight;
+    size_t originalObjectWidth;
+
+public:
+
+    CompactDataset(size_t channelsNum, size_t height, size_t width, size_t margin = 0) :
+        ImageDatasetReader<FPType, Normalizer>(channelsNum, height + 2 * margin, width + 2 * margin),
+        _numOfObjects(0), _position(0), originalObjectHeight(height), originalObjectWidth(width) { }
+
+    virtual ~CompactDataset() { }
+
+    /* Expands all objects into the train tensors */
+    virtual void read() { this->readTrainTensors(*this); }
+
+    void allocate(size_t numOfObjects)
+    {
+        Collection<size_t> pixelsDims;
+        pixelsDims.push_back(numOfObjects);
+        pixelsDims.push_back(this->numberOfChannels);
+        pixelsDims.push_back(originalObjectHeight);
+        pixelsDims.push_back(originalObjectWidth);
+        _pixels = makePooledTensor<uint8_t>(pixelsDims);
+
+        Collection<size_t> labelsDims;
+        labelsDims.push_back(numOfObjects);
+        _labels = makePooledTensor<uint8_t>(labelsDims);
+        Profiler::getInstance().addAllocation("compact dataset", _pixels->getSize() + _labels->getSize());
+
+        _numOfObjects = numOfObjects;
+        _position = 0;
+    }
+
+    inline uint8_t *getPixels() { return _pixels->getArray(); }
+    inline uint8_t *getLabels() { return _labels->getArray(); }
+    inline size_t getObjectSize() { return this->numberOfChannels * originalObjectHeight * originalObjectWidth; }
+
+    SharedPtr<Tensor> getCompactData() { return _pixels; }
+    SharedPtr<Tensor> getCompactGroundTruth() { return _labels; }
+
+    virtual size_t getNumberOfObjects() { return _numOfObjects; }
+
+    virtual Collection<size_t> getObjectDimensions()
+    {
+        Collection<size_t> dims;
+        dims.push_back(this->numberOfChannels);
+        dims.push_back(this->objectHeight);
+        dims.push_back(this->objectWidth);
+        return dims;
+    }
+
+    virtual size_t getPosition() { return _position; }
+    virtual void seek(size_t objectIndex) { _position = std::min(objectIndex, _numOfObjects); }
+
+    virtual size_t readChunk(FPType *data, FPType *labels, size_t maxObjects)
+    {
+        size_t count = std::min(maxObjects, _numOfObjects - _position);
+        this->normalizeObjects(getPixels() + _position * getObjectSize(), data, 0, count,
+                               originalObjectHeight, originalObjectWidth);
+
+        const uint8_t *classNumbers = getLabels() + _position;
+        for (size_t i = 0; i < count; i++)
+        {
+            labels[i] = (FPType)classNumbers[i];
+        }
+
+        _position += count;
+        return count;
+    }
+
+    virtual void readObjects(const size_t *indices, size_t numOfObjects, FPType *data, FPType *labels)
+    {
+        this->normalizeObjects(getPixels(), indices, data, numOfObjects, originalObjectHeight, originalObjectWidth);
+
+        const uint8_t *classNumbers = getLabels();
+        for (size_t i = 0; i < numOfObjects; i++)
+        {
+            labels[i] = (FPType)classNumbers[indices[i]];
+        }
+    }
+
+protected:
+
+    virtual size_t getNumberOfTrainObjects() { return _numOfObjects; }
+    virtual size_t getNumberOfTestObjects() { return 0; }
+};
+
+enum DatasetLoader
+{
+    streamLoader,   /* std::ifstream, one object per read call */
+    mmapLoader      /* memory-mapped file, objects are normalized straight from the mapping */
+};
+
+/* Layout of the MNIST IDX files: a big-endian header of a magic number and the dimensions, then the
+   unsigned bytes of the objects. Shared by the readers of whole batches, of chunks and of shards */
+class IdxFormat
+{
+public:
+
+    static const uint32_t LABELS_MAGIC_NUMBER = 0x00000801;
+    static const uint32_t DATA_MAGIC_NUMBER = 0x00000803;
+    /* Images with a channel dimension */
+    static const uint32_t DATA4_MAGIC_NUMBER = 0x00000804;
+    static const size_t DATA_HEADER_SIZE = 4 * sizeof(uint32_t);
+    static const size_t LABELS_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+    /* IDX header fields are big-endian and may be unaligned */
+    static inline uint32_t readDword(const uint8_t *bytes)
+    {
+        return
+            ((uint32_t)bytes[0] << 24) |
+            ((uint32_t)bytes[1] << 16) |
+            ((uint32_t)bytes[2] <<  8) |
+            ((uint32_t)bytes[3]);
+    }
+
+    static inline uint32_t readDword(std::ifstream &stream)
+    {
+        uint8_t bytes[sizeof(uint32_t)] = { 0, 0, 0, 0 };
+        stream.read((char *)bytes, sizeof(bytes));
+        return readDword(bytes);
+    }
+
+    static void checkDataHeader(uint32_t magicNumber, uint32_t numberOfImages, uint32_t numberOfRows, uint32_t numberOfColumns,
+                                size_t numOfObjects, size_t objectHeight, size_t objectWidth)
+    {
+        if (magicNumber != DATA_MAGIC_NUMBER)
+        {
+            throw std::runtime_error("Invalid data file format");
+        }
+
+        if (numberOfImages < numOfObjects)
+        {
+            throw std::runtime_error("Number of objects too large");
+        }
+
+        if (numberOfRows != objectHeight || numberOfColumns != objectWidth)
+        {
+            throw std::runtime_error("Batch contains invalid images");
+        }
+    }
+
+    static void checkLabelsHeader(uint32_t magicNumber, uint32_t numberOfItems, size_t numOfObjects)
+    {
+        if (magicNumber != LABELS_MAGIC_NUMBER)
+        {
+            throw std::runtime_error("Invalid data file format");
+        }
+
+        if (numberOfItems < numOfObjects)
+        {
+            throw std::runtime_error("Number of objects too large");
+        }
+    }
+
+    /* Objects or labels the header of a mapped file declares */
+    static size_t getNumberOfItems(const MappedFile &file)
+    {
+        if (file.size() < LABELS_HEADER_SIZE)
+        {
+            throw std::runtime_error("Invalid data file format");
+        }
+        return readDword(file.data() + 4);
+    }
+
+    /* Validates the header of a mapped data file in place and returns the pixels of the first object */
+    static const uint8_t *mapData(const MappedFile &file, size_t numOfObjects, size_t objectHeight, size_t objectWidth)
+    {
+        if (file.size() < DATA_HEADER_SIZE)
+        {
+            throw std::runtime_error("Invalid data file format");
+        }
+
+        const uint8_t *header = file.data();
+        checkDataHeader(readDword(header), readDword(header + 4), readDword(header + 8), readDword(header + 12), numOfObjects,
+                        objectHeight, objectWidth);
+
+        if (file.size() < DATA_HEADER_SIZE + numOfObjects * objectHeight * objectWidth)
+        {
+            throw std::runtime_error("Batch file is truncated");
+        }
+        return file.data() + DATA_HEADER_SIZE;
+    }
+
+    /* Validates the header of a mapped labels file in place and returns the label of the first object */
+    static const uint8_t *mapLabels(const MappedFile &file, size_t numOfObjects)
+    {
+        if (file.size() < LABELS_HEADER_SIZE)
+        {
+            throw std::runtime_error("Invalid data file format");
+        }
+
+        checkLabelsHeader(readDword(file.data()), readDword(file.data() + 4), numOfObjects);
+
+        if (file.size() < LABELS_HEADER_SIZE + numOfObjects)
+        {
+            throw std::runtime_error("Batch file is truncated");
+        }
+        return file.data() + LABELS_HEADER_SIZE;
+    }
+};
+
+template<typename FPType, typename Normalizer = RGBChannelNormalizer<FPType> >
+class DatasetReader_MNIST : public ImageDatasetReader<FPType, Normalizer>
+{
+private:
 
     std::string _trainPathData;
     std::string _trainPathLabels;
@@ -159,6 +663,8 @@ private:
     std::string _testPathLabels;
     size_t _numOfTrainObjects;
     size_t _numOfTestObjects;
+    DatasetLoader _loader;
+    std::string _cacheDirectory;
 
 public:
 
@@ -169,7 +675,7 @@ public:
 public:
 
     DatasetReader_MNIST(size_t margin = 0) : ImageDatasetReader<FPType, Normalizer>(1, 28 + 2 * margin, 28 + 2 * margin),
-        _numOfTrainObjects(0), _numOfTestObjects(0),
+        _numOfTrainObjects(0), _numOfTestObjects(0), _loader(mmapLoader),
         originalObjectWidth(28), originalObjectHeight(28), margins(margin) { }
 
     virtual ~DatasetReader_MNIST() { }
@@ -188,25 +694,52 @@ public:
         _numOfTestObjects = numOfObjects;
     }
 
+    inline void setLoader(DatasetLoader loader)
+    {
+        _loader = loader;
+    }
+
+    /* Normalized tensors are cached in the directory and mapped on later reads, empty path disables caching */
+    inline void setCacheDirectory(std::string cacheDirectory)
+    {
+        _cacheDirectory = std::move(cacheDirectory);
+    }
+
     virtual void read()
     {
         this->objectWidth = originalObjectWidth + 2 * margins;
         this->objectHeight = originalObjectHeight + 2 * margins;
-        this->allocateTensors();
 
         if (_numOfTrainObjects)
         {
-            readBatchDataFile(_trainPathData, this->_trainData, _numOfTrainObjects);
-            readBatchLabelsFile(_trainPathLabels, this->_trainGroundTruth, _numOfTrainObjects);
+            readBatch(_trainPathData, _trainPathLabels, _numOfTrainObjects, this->_trainData, this->_trainGroundTruth);
         }
 
         if (_numOfTestObjects > 0)
         {
-            readBatchDataFile(_testPathData, this->_testData, _numOfTestObjects);
-            readBatchLabelsFile(_testPathLabels, this->_testGroundTruth, _numOfTestObjects);
+            readBatch(_testPathData, _testPathLabels, _numOfTestObjects, this->_testData, this->_testGroundTruth);
         }
     }
 
+    /* Reads numOfObjects objects from firstObject on as raw pixels that are expanded chunk by chunk
+       when the dataset is used */
+    SharedPtr<CompactDataset<FPType, Normalizer> > readCompactBatch(const std::string &pathToBatchData,
+                                                                     const std::string &pathToBatchLabels, size_t numOfObjects,
+                                                                     size_t firstObject = 0)
+    {
+        SharedPtr<CompactDataset<FPType, Normalizer> > dataset(
+            new CompactDataset<FPType, Normalizer>(1, originalObjectHeight, originalObjectWidth, margins));
+        dataset->allocate(numOfObjects);
+
+        MappedFile dataFile(pathToBatchData);
+        memcpy(dataset->getPixels(), mapDataBatch(dataFile, numOfObjects, firstObject), numOfObjects * dataset->getObjectSize());
+
+        MappedFile labelsFile(pathToBatchLabels);
+        memcpy(dataset->getLabels(), mapLabelsBatch(labelsFile, firstObject + numOfObjects) + firstObject, numOfObjects);
+
+        return dataset;
+    }
+
 protected:
 
     virtual size_t getNumberOfTrainObjects() { return _numOfTrainObjects; }
@@ -214,81 +747,149 @@ protected:
 
 private:
 
+    void readBatch(const std::string &dataPath, const std::string &labelsPath, size_t numOfObjects,
+                   SharedPtr<HomogenTensor<FPType> > &data, SharedPtr<HomogenTensor<FPType> > &labels)
+    {
+        if (_cacheDirectory.empty())
+        {
+            this->allocateTensors(numOfObjects, data, labels);
+            readBatchDataFile(dataPath, data, numOfObjects);
+            readBatchLabelsFile(labelsPath, labels, numOfObjects);
+            return;
+        }
+
+        TensorCache<FPType> cache(getCachePath(dataPath, numOfObjects));
+        TensorCacheHeader header = cache.makeHeader(this->getDataDimensions(numOfObjects), margins,
+                                                    typeid(Normalizer).name(), dataPath, labelsPath);
+        if (cache.load(header, data, labels))
+        {
+            return;
+        }
+
+        /* Missing or stale cache is rebuilt from the IDX files */
+        this->allocateTensors(numOfObjects, data, labels);
+        readBatchDataFile(dataPath, data, numOfObjects);
+        readBatchLabelsFile(labelsPath, labels, numOfObjects);
+
+        /* The tensors are already read, a cache that cannot be written only costs the next run */
+        try
+        {
+            cache.save(header, data, labels);
+        }
+        catch (std::exception &e)
+        {
+            fprintf(stderr, "Warning: %s, continuing without the cache\n", e.what());
+        }
+    }
+
+    std::string getCachePath(const std::string &dataPath, size_t numOfObjects)
+    {
+        std::string fileName = dataPath.substr(dataPath.find_last_of('/') + 1);
+        char suffix[64];
+        snprintf(suffix, sizeof(suffix), ".n%lu.m%lu.fp%lu.cache",
+                 (unsigned long)numOfObjects, (unsigned long)margins, (unsigned long)(8 * sizeof(FPType)));
+        return _cacheDirectory + "/" + fileName + suffix;
+    }
+
     void readBatchDataFile(const std::string &batchPath, SharedPtr<HomogenTensor<FPType> > data, size_t numOfObjects)
     {
-        std::ifstream batchStream(batchPath.c_str(), std::ifstream::in | std::ifstream::binary);
         FPType *dataRaw = data->getArray();
+        if (_loader == mmapLoader)
+        {
+            MappedFile batchFile(batchPath);
+            readDataBatch(batchFile, dataRaw, numOfObjects);
+            return;
+        }
+
+        std::ifstream batchStream(batchPath.c_str(), std::ifstream::in | std::ifstream::binary);
         readDataBatch(batchStream, dataRaw, numOfObjects);
         batchStream.close();
     }
 
     void readBatchLabelsFile(const std::string &batchPath, SharedPtr<HomogenTensor<FPType> > labels, size_t numOfObjects)
     {
-        std::ifstream batchStream(batchPath.c_str(), std::ifstream::in | std::ifstream::binary);
         FPType *labelsRaw = labels->getArray();
+        if (_loader == mmapLoader)
+        {
+            MappedFile batchFile(batchPath);
+            readLabelsBatch(batchFile, labelsRaw, numOfObjects);
+            return;
+        }
+
+        std::ifstream batchStream(batchPath.c_str(), std::ifstream::in | std::ifstream::binary);
         readLabelsBatch(batchStream, labelsRaw, numOfObjects);
         batchStream.close();
     }
 
     void readDataBatch(std::ifstream &stream, FPType *tensorData, size_t numOfObjects)
     {
-        uint32_t magicNumber = readDword(stream);
-        if (magicNumber != DATA_MAGIC_NUMBER)
+        uint32_t magicNumber = IdxFormat::readDword(stream);
+        uint32_t numberOfImages = IdxFormat::readDword(stream);
+        uint32_t numberOfRows = IdxFormat::readDword(stream);
+        uint32_t numberOfColumns = IdxFormat::readDword(stream);
+        IdxFormat::checkDataHeader(magicNumber, numberOfImages, numberOfRows, numberOfColumns, numOfObjects,
+                                   originalObjectHeight, originalObjectWidth);
+
+        const size_t objectSize = originalObjectWidth * originalObjectHeight;
+        const size_t objectsPerRead = 1024;
+        PooledBuffer buffer(objectsPerRead * objectSize);
+        uint8_t *channelBuffer = (uint8_t *)buffer.get();
+
+        size_t objectCounter = 0;
+        while (objectCounter < numOfObjects && stream.good())
         {
-            throw std::runtime_error("Invalid data file format");
+            size_t count = std::min(objectsPerRead, numOfObjects - objectCounter);
+            stream.read((char *)channelBuffer, count * objectSize);
+            count = (size_t)stream.gcount() / objectSize;
+            copyObjects(channelBuffer, tensorData, objectCounter, count);
+            objectCounter += count;
         }
 
-        uint32_t numberOfImages = readDword(stream);
-        if (numberOfImages < numOfObjects)
-        {
-            throw std::runtime_error("Number of objects too large");
-        }
+        /* Objects missing from a truncated stream stay zero */
+        size_t tail = this->tensorOffset(objectCounter);
+        std::fill(tensorData + tail, tensorData + this->tensorOffset(numOfObjects), (FPType)0);
+    }
 
-        uint32_t numberOfRows = readDword(stream);
-        if (numberOfRows != originalObjectWidth)
-        {
-            throw std::runtime_error("Batch contains invalid images");
-        }
+    /* Normalizes pixels directly from the mapping */
+    void readDataBatch(MappedFile &file, FPType *tensorData, size_t numOfObjects)
+    {
+        copyObjects(mapDataBatch(file, numOfObjects), tensorData, 0, numOfObjects);
+    }
 
-        uint32_t numberOfColumns = readDword(stream);
-        if (numberOfColumns != originalObjectHeight)
-        {
-            throw std::runtime_error("Batch contains invalid images");
-        }
+    /* Validates the header in place and returns the pixels of firstObject, the batch from it on is read ahead */
+    const uint8_t *mapDataBatch(MappedFile &file, size_t numOfObjects, size_t firstObject = 0)
+    {
+        const size_t objectSize = originalObjectHeight * originalObjectWidth;
+        const uint8_t *pixels = IdxFormat::mapData(file, firstObject + numOfObjects, originalObjectHeight, originalObjectWidth);
+        file.adviseSequential(IdxFormat::DATA_HEADER_SIZE + firstObject * objectSize, numOfObjects * objectSize);
+        return pixels + firstObject * objectSize;
+    }
 
-        size_t bufferSize = originalObjectWidth * originalObjectHeight;
-        uint8_t *channelBuffer = new uint8_t[bufferSize];
+    /* Writes objects into the tensor surrounded by zero margins */
+    inline void copyObjects(const uint8_t *pixels, FPType *tensorData, size_t firstObject, size_t numOfObjects)
+    {
+        this->normalizeObjects(pixels, tensorData, firstObject, numOfObjects, originalObjectHeight, originalObjectWidth);
+    }
 
-        FPType *tensorDataPtr;
-        for (size_t objectCounter = 0; objectCounter < numOfObjects && stream.good(); objectCounter++)
+    void readLabelsBatch(MappedFile &file, FPType *labelsData, size_t numOfObjects)
+    {
+        const uint8_t *labels = mapLabelsBatch(file, numOfObjects);
+        for (size_t objectCounter = 0; objectCounter < numOfObjects; objectCounter++)
         {
-            stream.read((char *)channelBuffer, bufferSize);
-            tensorDataPtr = tensorData + this->tensorOffset(objectCounter);
-            tensorDataPtr += margins * this->objectWidth;
-            for (size_t i = 0; i < originalObjectHeight; i++)
-            {
-                tensorDataPtr += margins;
-                this->normalizeBuffer(channelBuffer + i * originalObjectWidth, tensorDataPtr, originalObjectWidth);
-                tensorDataPtr += originalObjectWidth + margins;
-            }
+            labelsData[objectCounter] = (FPType)labels[objectCounter];
         }
+    }
 
-        delete[] channelBuffer;
+    const uint8_t *mapLabelsBatch(MappedFile &file, size_t numOfObjects)
+    {
+        return IdxFormat::mapLabels(file, numOfObjects);
     }
 
     void readLabelsBatch(std::ifstream &stream, FPType *labelsData, size_t numOfObjects)
     {
-        uint32_t magicNumber = readDword(stream);
-        if (magicNumber != LABELS_MAGIC_NUMBER)
-        {
-            throw std::runtime_error("Invalid data file format");
-        }
-
-        uint32_t numberOfItems = readDword(stream);
-        if (numberOfItems < numOfObjects)
-        {
-            throw std::runtime_error("Number of objects too large");
-        }
+        uint32_t magicNumber = IdxFormat::readDword(stream);
+        uint32_t numberOfItems = IdxFormat::readDword(stream);
+        IdxFormat::checkLabelsHeader(magicNumber, numberOfItems, numOfObjects);
 
         char classNumber;
         for (size_t objectCounter = 0; objectCounter < numOfObjects && stream.good(); objectCounter++)
@@ -298,20 +899,108 @@ private:
         }
     }
 
-    inline uint32_t readDword(std::ifstream &stream)
+};
+
+
+template<typename FPType, typename Normalizer = RGBChannelNormalizer<FPType> >
+class DatasetChunkReader_MNIST : public ImageDatasetReader<FPType, Normalizer>, public DatasetChunkReader<FPType>
+{
+private:
+
+    MappedFile _dataFile;
+    MappedFile _labelsFile;
+    const uint8_t *_pixels;
+    const uint8_t *_classNumbers;
+    size_t _numOfObjects;
+    size_t _position;
+
+public:
+
+    size_t originalObjectHeight;
+    size_t originalObjectWidth;
+
+public:
+
+    DatasetChunkReader_MNIST(size_t margin = 0) : ImageDatasetReader<FPType, Normalizer>(1, 28 + 2 * margin, 28 + 2 * margin),
+        _pixels(NULL), _classNumbers(NULL), _numOfObjects(0), _position(0), originalObjectHeight(28), originalObjectWidth(28) { }
+
+    virtual ~DatasetChunkReader_MNIST() { }
+
+    /* Reads all objects into the train tensors */
+    virtual void read() { this->readTrainTensors(*this); }
+
+    /* Maps the files and validates their headers, objects are read later by readChunk */
+    void open(const std::string &pathToData, const std::string &pathToLabels, size_t numOfObjects)
     {
-        uint32_t dword;
-        stream.read((char *)(&dword), sizeof(uint32_t));
-        return endianDwordConversion(dword);
+        _dataFile.open(pathToData);
+        _labelsFile.open(pathToLabels);
+
+        _numOfObjects = numOfObjects ? numOfObjects :
+                        std::min(IdxFormat::getNumberOfItems(_dataFile), IdxFormat::getNumberOfItems(_labelsFile));
+        _pixels = IdxFormat::mapData(_dataFile, _numOfObjects, originalObjectHeight, originalObjectWidth);
+        _classNumbers = IdxFormat::mapLabels(_labelsFile, _numOfObjects);
+
+        seek(0);
     }
 
-    inline uint32_t endianDwordConversion(uint32_t dword)
+    virtual size_t getNumberOfObjects() { return _numOfObjects; }
+
+    virtual Collection<size_t> getObjectDimensions()
     {
-        return
-            ((dword >> 24) & 0x000000FF) |
-            ((dword >>  8) & 0x0000FF00) |
-            ((dword <<  8) & 0x00FF0000) |
-            ((dword << 24) & 0xFF000000);
+        Collection<size_t> dims;
+        dims.push_back(this->numberOfChannels);
+        dims.push_back(this->objectHeight);
+        dims.push_back(this->objectWidth);
+        return dims;
+    }
+
+    virtual size_t getPosition() { return _position; }
+
+    virtual void seek(size_t objectIndex)
+    {
+        _position = std::min(objectIndex, _numOfObjects);
     }
 
+    virtual size_t readChunk(FPType *data, FPType *labels, size_t maxObjects)
+    {
+        size_t count = std::min(maxObjects, _numOfObjects - _position);
+        size_t dataOffset = IdxFormat::DATA_HEADER_SIZE + _position * objectSize();
+
+        /* Only the pages of this chunk are read ahead, the rest of the file may never be trained on */
+        _dataFile.adviseSequential(dataOffset, count * objectSize());
+        this->normalizeObjects(_pixels + _position * objectSize(), data, 0, count, originalObjectHeight, originalObjectWidth);
+
+        const uint8_t *classNumbers = _classNumbers + _position;
+        for (size_t i = 0; i < count; i++)
+        {
+            labels[i] = (FPType)classNumbers[i];
+        }
+
+        /* Consumed pages are not needed until the next pass, keep the resident set bounded */
+        _dataFile.release(dataOffset, count * objectSize());
+
+        _position += count;
+        return count;
+    }
+
+    virtual void readObjects(const size_t *indices, size_t numOfObjects, FPType *data, FPType *labels)
+    {
+        this->normalizeObjects(_pixels, indices, data, numOfObjects, originalObjectHeight, originalObjectWidth);
+
+        for (size_t i = 0; i < numOfObjects; i++)
+        {
+            labels[i] = (FPType)_classNumbers[indices[i]];
+        }
+    }
+
+protected:
+
+    virtual size_t getNumberOfTrainObjects() { return _numOfObjects; }
+    virtual size_t getNumberOfTestObjects() { return 0; }
+
+private:
+
+    inline size_t objectSize() { return originalObjectHeight * originalObjectWidth; }
 };
+
+#endif
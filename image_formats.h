@@ -0,0 +1,407 @@
+/* file: image_formats.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Readers of CIFAR binary batches, raw NCHW dumps and directories of IDX shards,
+!    decoded from memory-mapped files by the parallel core of ImageDatasetReader
+!******************************************************************************/
+
+#ifndef _IMAGE_FORMATS_H
+#define _IMAGE_FORMATS_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <dirent.h>
+#include "image_dataset.h"
+
+/* Consecutive objects of a mapped file. The planar pixels of object i start at pixels + i * pixelStride,
+   its label is the byte at labels + i * labelStride. Labels may come from the same file as the pixels */
+struct ImageShard
+{
+    SharedPtr<MappedFile> pixelsFile;
+    SharedPtr<MappedFile> labelsFile;
+    const uint8_t *pixels;
+    const uint8_t *labels;
+    size_t pixelStride;
+    size_t labelStride;
+    size_t numOfObjects;
+};
+
+/* Dataset of one or more shards read as one sequence of objects, in chunks or as a whole.
+   Format readers only map their files and describe where the objects are */
+template<typename FPType, typename Normalizer = RGBChannelNormalizer<FPType> >
+class ShardedImageDataset : public ImageDatasetReader<FPType, Normalizer>, public DatasetChunkReader<FPType>
+{
+public:
+
+    size_t originalObjectHeight;
+    size_t originalObjectWidth;
+    size_t margins;
+
+    virtual ~ShardedImageDataset() { }
+
+    /* Reads all objects into the train tensors */
+    virtual void read() { this->readTrainTensors(*this); }
+
+    virtual size_t getNumberOfObjects() { return _numOfObjects; }
+
+    virtual Collection<size_t> getObjectDimensions()
+    {
+        Collection<size_t> dims;
+        dims.push_back(this->numberOfChannels);
+        dims.push_back(this->objectHeight);
+        dims.push_back(this->objectWidth);
+        return dims;
+    }
+
+    inline size_t getNumberOfShards() { return _shards.size(); }
+
+    virtual size_t getPosition() { return _position; }
+
+    virtual void seek(size_t objectIndex)
+    {
+        _position = std::min(objectIndex, _numOfObjects);
+        if (_position < _numOfObjects)
+        {
+            const size_t s = findShard(_position);
+            const ImageShard &shard = _shards[s];
+            shard.pixelsFile->adviseSequential(getPixelsOffset(shard, _position - _firstObjects[s]));
+        }
+    }
+
+    virtual size_t readChunk(FPType *data, FPType *labels, size_t maxObjects)
+    {
+        const size_t count = std::min(maxObjects, _numOfObjects - _position);
+        for (size_t done = 0; done < count;)
+        {
+            const size_t s = findShard(_position);
+            const ImageShard &shard = _shards[s];
+            const size_t first = _position - _firstObjects[s];
+            const size_t n = std::min(count - done, shard.numOfObjects - first);
+
+            this->normalizeObjects(shard.pixels + first * shard.pixelStride, data, done, n,
+                                   originalObjectHeight, originalObjectWidth, shard.pixelStride);
+            for (size_t i = 0; i < n; i++)
+            {
+                labels[done + i] = (FPType)shard.labels[(first + i) * shard.labelStride];
+            }
+
+            /* Consumed pages are not needed until the next pass, keep the resident set bounded */
+            shard.pixelsFile->release(getPixelsOffset(shard, first), n * shard.pixelStride);
+
+            _position += n;
+            done += n;
+        }
+        return count;
+    }
+
+    virtual void readObjects(const size_t *indices, size_t numOfObjects, FPType *data, FPType *labels)
+    {
+        this->decodeObjects([&](size_t i) -> const uint8_t *
+        {
+            const size_t s = findShard(indices[i]);
+            return _shards[s].pixels + (indices[i] - _firstObjects[s]) * _shards[s].pixelStride;
+        }, data, 0, numOfObjects, originalObjectHeight, originalObjectWidth);
+
+        for (size_t i = 0; i < numOfObjects; i++)
+        {
+            const size_t s = findShard(indices[i]);
+            labels[i] = (FPType)_shards[s].labels[(indices[i] - _firstObjects[s]) * _shards[s].labelStride];
+        }
+    }
+
+protected:
+
+    ShardedImageDataset(size_t channelsNum, size_t height, size_t width, size_t margin) :
+        ImageDatasetReader<FPType, Normalizer>(channelsNum, height + 2 * margin, width + 2 * margin),
+        originalObjectHeight(height), originalObjectWidth(width), margins(margin), _numOfObjects(0), _position(0) { }
+
+    /* Sizes of the objects for formats that store them in the files */
+    void setObjectDimensions(size_t channelsNum, size_t height, size_t width)
+    {
+        this->numberOfChannels = channelsNum;
+        originalObjectHeight = height;
+        originalObjectWidth = width;
+        this->objectHeight = height + 2 * margins;
+        this->objectWidth = width + 2 * margins;
+    }
+
+    inline size_t getObjectSize() { return this->numberOfChannels * originalObjectHeight * originalObjectWidth; }
+
+    void clearShards()
+    {
+        _shards.clear();
+        _firstObjects.clear();
+        _numOfObjects = 0;
+        _position = 0;
+    }
+
+    void addShard(const ImageShard &shard)
+    {
+        if (shard.numOfObjects == 0)
+        {
+            return;
+        }
+        _shards.push_back(shard);
+        _firstObjects.push_back(_numOfObjects);
+        _numOfObjects += shard.numOfObjects;
+    }
+
+    /* Keeps the first numOfObjects objects of the shards, 0 keeps all of them */
+    void limitObjects(size_t numOfObjects)
+    {
+        if (numOfObjects > _numOfObjects)
+        {
+            throw std::runtime_error("Number of objects too large");
+        }
+        if (numOfObjects > 0)
+        {
+            while (_firstObjects.back() >= numOfObjects)
+            {
+                _shards.pop_back();
+                _firstObjects.pop_back();
+            }
+            _shards.back().numOfObjects = numOfObjects - _firstObjects.back();
+            _numOfObjects = numOfObjects;
+        }
+        seek(0);
+    }
+
+    virtual size_t getNumberOfTrainObjects() { return _numOfObjects; }
+    virtual size_t getNumberOfTestObjects() { return 0; }
+
+private:
+
+    inline size_t findShard(size_t objectIndex) const
+    {
+        return std::upper_bound(_firstObjects.begin(), _firstObjects.end(), objectIndex) - _firstObjects.begin() - 1;
+    }
+
+    inline size_t getPixelsOffset(const ImageShard &shard, size_t objectIndex) const
+    {
+        return shard.pixels - shard.pixelsFile->data() + objectIndex * shard.pixelStride;
+    }
+
+    std::vector<ImageShard> _shards;
+    /* Index of the first object of every shard in the dataset */
+    std::vector<size_t> _firstObjects;
+    size_t _numOfObjects;
+    size_t _position;
+};
+
+/* Label of the CIFAR records: CIFAR-10 records have one label byte, CIFAR-100 records a coarse and a fine one */
+enum CifarLabels
+{
+    cifar10Labels,
+    cifar100CoarseLabels,
+    cifar100FineLabels
+};
+
+/* CIFAR binary batches, records of the label bytes followed by 32x32 pixels of red, green and blue planes */
+template<typename FPType, typename Normalizer = RGBChannelNormalizer<FPType> >
+class DatasetReader_CIFAR : public ShardedImageDataset<FPType, Normalizer>
+{
+public:
+
+    DatasetReader_CIFAR(CifarLabels labels = cifar10Labels, size_t margin = 0) :
+        ShardedImageDataset<FPType, Normalizer>(3, 32, 32, margin), _labels(labels) { }
+
+    virtual ~DatasetReader_CIFAR() { }
+
+    /* Maps the batch files, their records form one dataset in the order of the files */
+    void open(const std::vector<std::string> &batchPaths, size_t numOfObjects = 0)
+    {
+        const size_t labelBytes = _labels == cifar10Labels ? 1 : 2;
+        const size_t recordSize = labelBytes + this->getObjectSize();
+
+        this->clearShards();
+        for (size_t i = 0; i < batchPaths.size(); i++)
+        {
+            ImageShard shard;
+            shard.pixelsFile = SharedPtr<MappedFile>(new MappedFile(batchPaths[i]));
+            shard.labelsFile = shard.pixelsFile;
+            if (shard.pixelsFile->size() % recordSize != 0)
+            {
+                throw std::runtime_error("Batch file is truncated");
+            }
+            shard.labels = shard.pixelsFile->data() + (_labels == cifar100FineLabels ? 1 : 0);
+            shard.pixels = shard.pixelsFile->data() + labelBytes;
+            shard.pixelStride = recordSize;
+            shard.labelStride = recordSize;
+            shard.numOfObjects = shard.pixelsFile->size() / recordSize;
+            this->addShard(shard);
+        }
+        this->limitObjects(numOfObjects);
+    }
+
+private:
+    CifarLabels _labels;
+};
+
+/* Headerless dump of uint8 objects in NCHW order and a file of one uint8 label per object */
+template<typename FPType, typename Normalizer = RGBChannelNormalizer<FPType> >
+class DatasetReader_RawNCHW : public ShardedImageDataset<FPType, Normalizer>
+{
+public:
+
+    DatasetReader_RawNCHW(size_t channelsNum, size_t height, size_t width, size_t margin = 0) :
+        ShardedImageDataset<FPType, Normalizer>(channelsNum, height, width, margin) { }
+
+    virtual ~DatasetReader_RawNCHW() { }
+
+    void open(const std::string &pathToData, const std::string &pathToLabels, size_t numOfObjects = 0)
+    {
+        ImageShard shard;
+        shard.pixelsFile = SharedPtr<MappedFile>(new MappedFile(pathToData));
+        shard.labelsFile = SharedPtr<MappedFile>(new MappedFile(pathToLabels));
+        if (shard.pixelsFile->size() % this->getObjectSize() != 0)
+        {
+            throw std::runtime_error("Batch file is truncated");
+        }
+        shard.pixels = shard.pixelsFile->data();
+        shard.labels = shard.labelsFile->data();
+        shard.pixelStride = this->getObjectSize();
+        shard.labelStride = 1;
+        shard.numOfObjects = std::min(shard.pixelsFile->size() / this->getObjectSize(), shard.labelsFile->size());
+
+        this->clearShards();
+        this->addShard(shard);
+        this->limitObjects(numOfObjects);
+    }
+};
+
+/* Directory of IDX files split into shards, e.g. train-images-idx3-ubyte.000 and train-labels-idx1-ubyte.000.
+   Images are IDX3 (count, height, width) or IDX4 (count, channels, height, width) files, labels IDX1 files.
+   The image and the label files of the directory are paired in the order of their names */
+template<typename FPType, typename Normalizer = RGBChannelNormalizer<FPType> >
+class DatasetReader_IDXShards : public ShardedImageDataset<FPType, Normalizer>
+{
+public:
+
+    DatasetReader_IDXShards(size_t margin = 0) : ShardedImageDataset<FPType, Normalizer>(1, 0, 0, margin) { }
+
+    virtual ~DatasetReader_IDXShards() { }
+
+    /* Maps the IDX files of the directory whose names start with prefix, other files are ignored */
+    void open(const std::string &directory, const std::string &prefix = "", size_t numOfObjects = 0)
+    {
+        std::vector<std::string> imagePaths, labelPaths;
+        listShards(directory, prefix, imagePaths, labelPaths);
+        if (imagePaths.empty() || imagePaths.size() != labelPaths.size())
+        {
+            throw std::runtime_error("Directory " + directory + " has no matching image and label shards");
+        }
+
+        this->clearShards();
+        for (size_t i = 0; i < imagePaths.size(); i++)
+        {
+            ImageShard shard;
+            shard.pixelsFile = SharedPtr<MappedFile>(new MappedFile(imagePaths[i]));
+            shard.labelsFile = SharedPtr<MappedFile>(new MappedFile(labelPaths[i]));
+
+            const uint8_t *header = shard.pixelsFile->data();
+            const size_t numOfDims = header[3];
+            if (shard.pixelsFile->size() < 4 + 4 * numOfDims || shard.labelsFile->size() < IdxFormat::LABELS_HEADER_SIZE)
+            {
+                throw std::runtime_error("Invalid data file format");
+            }
+            size_t channels = 1;
+            if (numOfDims == 4)
+            {
+                channels = IdxFormat::readDword(header + 8);
+            }
+            const size_t height = IdxFormat::readDword(header + 4 * numOfDims - 4);
+            const size_t width = IdxFormat::readDword(header + 4 * numOfDims);
+            if (i == 0)
+            {
+                this->setObjectDimensions(channels, height, width);
+            }
+            else if (channels != this->numberOfChannels || height != this->originalObjectHeight || width != this->originalObjectWidth)
+            {
+                throw std::runtime_error("Shard " + imagePaths[i] + " contains images of another size");
+            }
+
+            const size_t dataHeaderSize = 4 + 4 * numOfDims;
+            const size_t numOfImages = IdxFormat::readDword(header + 4);
+            const size_t numOfLabels = IdxFormat::readDword(shard.labelsFile->data() + 4);
+            if (numOfImages != numOfLabels)
+            {
+                throw std::runtime_error("Shards " + imagePaths[i] + " and " + labelPaths[i] + " differ in the number of objects");
+            }
+            if (shard.pixelsFile->size() < dataHeaderSize + numOfImages * this->getObjectSize() ||
+                shard.labelsFile->size() < IdxFormat::LABELS_HEADER_SIZE + numOfLabels)
+            {
+                throw std::runtime_error("Batch file is truncated");
+            }
+
+            shard.pixels = header + dataHeaderSize;
+            shard.labels = shard.labelsFile->data() + IdxFormat::LABELS_HEADER_SIZE;
+            shard.pixelStride = this->getObjectSize();
+            shard.labelStride = 1;
+            shard.numOfObjects = numOfImages;
+            this->addShard(shard);
+        }
+        this->limitObjects(numOfObjects);
+    }
+
+private:
+
+    /* Image and label files by the magic number of their header, each in the order of the names */
+    static void listShards(const std::string &directory, const std::string &prefix,
+                           std::vector<std::string> &imagePaths, std::vector<std::string> &labelPaths)
+    {
+        DIR *dir = opendir(directory.c_str());
+        if (!dir)
+        {
+            throw std::runtime_error("Unable to open directory " + directory);
+        }
+        std::vector<std::string> names;
+        for (struct dirent *entry = readdir(dir); entry; entry = readdir(dir))
+        {
+            const std::string name = entry->d_name;
+            if (name[0] != '.' && name.compare(0, prefix.size(), prefix) == 0)
+            {
+                names.push_back(name);
+            }
+        }
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            const std::string path = directory + "/" + names[i];
+            uint8_t header[4];
+            FILE *file = fopen(path.c_str(), "rb");
+            if (!file)
+            {
+                continue;
+            }
+            const bool complete = fread(header, 1, sizeof(header), file) == sizeof(header);
+            fclose(file);
+            if (!complete)
+            {
+                continue;
+            }
+
+            const uint32_t magicNumber = IdxFormat::readDword(header);
+            if (magicNumber == IdxFormat::DATA_MAGIC_NUMBER || magicNumber == IdxFormat::DATA4_MAGIC_NUMBER)
+            {
+                imagePaths.push_back(path);
+            }
+            else if (magicNumber == IdxFormat::LABELS_MAGIC_NUMBER)
+            {
+                labelPaths.push_back(path);
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,485 @@
+/* file: inference_server.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    LeNet inference over a local Unix socket with requests coalesced into dynamic batches
+!******************************************************************************/
+
+#ifndef _INFERENCE_SERVER_H
+#define _INFERENCE_SERVER_H
+
+#include "lenet_pipeline.h"
+#include "lenet_native.h"
+#include <deque>
+#include <set>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <condition_variable>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Protocol: a request is one image of raw uint8 pixels, the answer to it is an InferenceResponse.
+   A connection may send its next request before the previous answer arrives, answers keep the order */
+struct InferenceResponse
+{
+    int32_t label;
+    float probability;
+};
+
+/* Latencies of answered requests */
+class LatencyStatistics
+{
+public:
+
+    void add(double latency) { _latencies.push_back(latency); }
+
+    void merge(const LatencyStatistics &other)
+    {
+        _latencies.insert(_latencies.end(), other._latencies.begin(), other._latencies.end());
+    }
+
+    inline size_t size() const { return _latencies.size(); }
+
+    /* Nearest-rank percentile in seconds */
+    double percentile(double p) const
+    {
+        if (_latencies.empty()) { return 0; }
+        std::vector<double> sorted(_latencies);
+        size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+        rank = std::min(std::max<size_t>(rank, 1), sorted.size());
+        std::nth_element(sorted.begin(), sorted.begin() + (rank - 1), sorted.end());
+        return sorted[rank - 1];
+    }
+
+    void print(const char *name, double elapsedTime) const
+    {
+        printf("%s: %lu requests in %.3f s, %.0f requests/s, latency p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+               name, (unsigned long)size(), elapsedTime, elapsedTime > 0 ? size() / elapsedTime : 0.0,
+               percentile(50) * 1000, percentile(99) * 1000, percentile(100) * 1000);
+    }
+
+private:
+    std::vector<double> _latencies;
+};
+
+/* Helpers for blocking stream sockets, false means the peer closed the connection */
+inline bool sendAll(int fd, const void *ptr, size_t size)
+{
+    const char *bytes = (const char *)ptr;
+    while (size > 0)
+    {
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) { continue; }
+        if (sent <= 0) { return false; }
+        bytes += sent;
+        size -= (size_t)sent;
+    }
+    return true;
+}
+
+inline bool receiveAll(int fd, void *ptr, size_t size)
+{
+    char *bytes = (char *)ptr;
+    while (size > 0)
+    {
+        ssize_t received = recv(fd, bytes, size, 0);
+        if (received < 0 && errno == EINTR) { continue; }
+        if (received <= 0) { return false; }
+        bytes += received;
+        size -= (size_t)received;
+    }
+    return true;
+}
+
+inline sockaddr_un unixAddress(const std::string &path)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error("Socket path " + path + " is too long");
+    }
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    return address;
+}
+
+/* Serves a prediction model to local clients. Every connection has a thread that queues its requests,
+   the serving thread takes the queued requests as one batch once there are maxBatchSize of them
+   or the oldest one has waited for latencyBudget seconds. Answers are sent without blocking, the bytes
+   the socket does not take yet are sent later, so that no answer is cut. A client that leaves more than
+   MAX_UNSENT_ANSWERS answers unread is disconnected instead of stalling the others */
+template<typename FPType, typename Normalizer = RGBChannelNormalizer<FPType> >
+class InferenceServer
+{
+public:
+
+    static const size_t MAX_UNSENT_ANSWERS = 1024;
+
+    InferenceServer(const prediction::ModelPtr &model, size_t height, size_t width, size_t margin,
+                    size_t maxBatchSize, double latencyBudget) :
+        _staging(1, height, width, margin), _maxBatchSize(std::max<size_t>(maxBatchSize, 1)),
+        _latencyBudget(latencyBudget), _listenFd(-1), _numOfReaders(0), _numOfBatches(0), _numOfDropped(0), _servingTime(0)
+    {
+        _staging.allocate(_maxBatchSize);
+        _chunk = SharedPtr<TensorChunk<FPType> >(new TensorChunk<FPType>(_staging.getObjectDimensions(), _maxBatchSize));
+        _net.input.set(prediction::model, model);
+    }
+
+    ~InferenceServer() { stop(); }
+
+    /* Answers with the fused native network instead of prediction::Batch */
+    void setNativeNet(const SharedPtr<NativeLeNet<FPType> > &nativeNet)
+    {
+        _nativeNet = nativeNet;
+        _probabilities.resize(_maxBatchSize * NativeLeNet<FPType>::F4);
+    }
+
+    void start(const std::string &socketPath)
+    {
+        sockaddr_un address = unixAddress(socketPath);
+        unlink(socketPath.c_str());
+
+        _listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (_listenFd < 0 || bind(_listenFd, (sockaddr *)&address, sizeof(address)) != 0 || listen(_listenFd, 128) != 0)
+        {
+            throw std::runtime_error("Unable to listen on socket " + socketPath);
+        }
+        _socketPath = socketPath;
+        _acceptor = std::thread(&InferenceServer::acceptConnections, this);
+    }
+
+    /* Answers requests in the calling thread until the flag is set, e.g. by a signal handler */
+    void serve(volatile sig_atomic_t &interrupted)
+    {
+        const std::chrono::duration<double> budget(_latencyBudget);
+        std::vector<Request> batch;
+
+        while (!interrupted)
+        {
+            sendUnsent();
+
+            {
+                /* Answers left in the send buffers are retried every millisecond */
+                const std::chrono::milliseconds idle(_unsentConnections.empty() ? 100 : 1);
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (!_arrived.wait_for(lock, idle, [this] { return !_pending.empty(); }))
+                {
+                    continue;
+                }
+
+                std::chrono::steady_clock::time_point deadline =
+                    _pending.front().arrival + std::chrono::duration_cast<std::chrono::steady_clock::duration>(budget);
+                _arrived.wait_until(lock, deadline, [this] { return _pending.size() >= _maxBatchSize; });
+
+                size_t n = std::min(_pending.size(), _maxBatchSize);
+                batch.assign(_pending.begin(), _pending.begin() + n);
+                _pending.erase(_pending.begin(), _pending.begin() + n);
+            }
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            process(batch);
+            _servingTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    /* Stops accepting connections and closes the open ones */
+    void stop()
+    {
+        if (_listenFd < 0) { return; }
+
+        shutdown(_listenFd, SHUT_RDWR);
+        _acceptor.join();
+        close(_listenFd);
+        _listenFd = -1;
+        unlink(_socketPath.c_str());
+
+        std::unique_lock<std::mutex> lock(_connectionsMutex);
+        for (std::set<int>::iterator it = _connections.begin(); it != _connections.end(); ++it)
+        {
+            shutdown(*it, SHUT_RDWR);
+        }
+        _readersFinished.wait(lock, [this] { return _numOfReaders == 0; });
+    }
+
+    inline const LatencyStatistics &getLatencies() { return _latencies; }
+    inline size_t getNumberOfBatches() { return _numOfBatches; }
+    /* Clients disconnected because they left more than MAX_UNSENT_ANSWERS answers unread */
+    inline size_t getNumberOfDropped() { return _numOfDropped; }
+    /* Seconds spent on normalization, prediction and answers */
+    inline double getServingTime() { return _servingTime; }
+    /* Seconds from the first request to the last answer */
+    inline double getActiveTime() { return std::chrono::duration<double>(_lastAnswer - _firstRequest).count(); }
+
+private:
+
+    struct Connection
+    {
+        int fd;
+        /* Set by the serving thread once the client is disconnected, later answers are discarded */
+        bool dropped;
+        /* Bytes of answers the socket did not take yet, only used by the serving thread */
+        std::vector<char> unsent;
+        Connection(int descriptor) : fd(descriptor), dropped(false) { }
+        ~Connection() { close(fd); }
+    };
+
+    struct Request
+    {
+        SharedPtr<Connection> connection;
+        std::vector<uint8_t> pixels;
+        std::chrono::steady_clock::time_point arrival;
+    };
+
+    void acceptConnections()
+    {
+        for (;;)
+        {
+            int fd = accept(_listenFd, NULL, NULL);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED) { continue; }
+                break;
+            }
+
+            SharedPtr<Connection> connection(new Connection(fd));
+            std::lock_guard<std::mutex> lock(_connectionsMutex);
+            _connections.insert(fd);
+            _numOfReaders++;
+            std::thread(&InferenceServer::receiveRequests, this, connection).detach();
+        }
+    }
+
+    void receiveRequests(SharedPtr<Connection> connection)
+    {
+        Request request;
+        request.connection = connection;
+        request.pixels.resize(_staging.getObjectSize());
+
+        while (receiveAll(connection->fd, &request.pixels[0], request.pixels.size()))
+        {
+            request.arrival = std::chrono::steady_clock::now();
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            _pending.push_back(request);
+            _arrived.notify_one();
+        }
+
+        /* The descriptor stays open until the queued requests of the connection are answered */
+        std::lock_guard<std::mutex> lock(_connectionsMutex);
+        _connections.erase(connection->fd);
+        _numOfReaders--;
+        _readersFinished.notify_all();
+    }
+
+    void process(const std::vector<Request> &batch)
+    {
+        const size_t n = batch.size();
+        const size_t objectSize = _staging.getObjectSize();
+        for (size_t i = 0; i < n; i++)
+        {
+            memcpy(_staging.getPixels() + i * objectSize, &batch[i].pixels[0], objectSize);
+        }
+        _staging.seek(0);
+        _staging.readChunk(_chunk->data->getArray(), _chunk->groundTruth->getArray(), n);
+
+        TensorPtr prediction;
+        SubtensorDescriptor<FPType> block;
+        const FPType *probabilities;
+        size_t nClasses;
+        if (_nativeNet)
+        {
+            _nativeNet->forward(_chunk->data->getArray(), n, &_probabilities[0]);
+            probabilities = &_probabilities[0];
+            nClasses = NativeLeNet<FPType>::F4;
+        }
+        else
+        {
+            _net.input.set(prediction::data, _chunk->getData(n));
+            _net.compute();
+
+            prediction = _net.getResult()->get(prediction::prediction);
+            nClasses = prediction->getDimensionSize(1);
+            prediction->getSubtensor(0, 0, 0, n, readOnly, block);
+            probabilities = block.getPtr();
+        }
+
+        for (size_t i = 0; i < n; i++)
+        {
+            const FPType *p = probabilities + i * nClasses;
+            InferenceResponse response;
+            response.label = (int32_t)(std::max_element(p, p + nClasses) - p);
+            response.probability = (float)p[response.label];
+
+            if (!answer(batch[i].connection, response))
+            {
+                continue;
+            }
+            _latencies.add(std::chrono::duration<double>(std::chrono::steady_clock::now() - batch[i].arrival).count());
+        }
+        if (prediction)
+        {
+            prediction->releaseSubtensor(block);
+        }
+
+        if (_numOfBatches == 0)
+        {
+            _firstRequest = batch[0].arrival;
+        }
+        _lastAnswer = std::chrono::steady_clock::now();
+        _numOfBatches++;
+    }
+
+    /* Queues the answer behind the unsent bytes of the connection and sends what the socket takes,
+       returns false if the client is or gets disconnected */
+    bool answer(const SharedPtr<Connection> &connection, const InferenceResponse &response)
+    {
+        if (connection->dropped)
+        {
+            return false;
+        }
+
+        const bool waiting = !connection->unsent.empty();
+        const char *bytes = (const char *)&response;
+        connection->unsent.insert(connection->unsent.end(), bytes, bytes + sizeof(response));
+        if (connection->unsent.size() > MAX_UNSENT_ANSWERS * sizeof(response) || !sendAvailable(*connection))
+        {
+            drop(*connection);
+            return false;
+        }
+        if (!waiting && !connection->unsent.empty())
+        {
+            _unsentConnections.push_back(connection);
+        }
+        return true;
+    }
+
+    /* Sends the unsent bytes until the socket buffer is full, false if the peer is gone */
+    static bool sendAvailable(Connection &connection)
+    {
+        size_t offset = 0;
+        while (offset < connection.unsent.size())
+        {
+            ssize_t sent = send(connection.fd, &connection.unsent[offset], connection.unsent.size() - offset,
+                                MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (sent < 0 && errno == EINTR) { continue; }
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) { break; }
+            if (sent <= 0) { return false; }
+            offset += (size_t)sent;
+        }
+        connection.unsent.erase(connection.unsent.begin(), connection.unsent.begin() + offset);
+        return true;
+    }
+
+    void sendUnsent()
+    {
+        size_t kept = 0;
+        for (size_t i = 0; i < _unsentConnections.size(); i++)
+        {
+            Connection &connection = *_unsentConnections[i];
+            if (!connection.dropped && !sendAvailable(connection))
+            {
+                drop(connection);
+            }
+            if (!connection.dropped && !connection.unsent.empty())
+            {
+                _unsentConnections[kept++] = _unsentConnections[i];
+            }
+        }
+        _unsentConnections.resize(kept);
+    }
+
+    void drop(Connection &connection)
+    {
+        /* Its reader thread sees the shutdown and releases the connection */
+        connection.dropped = true;
+        connection.unsent.clear();
+        shutdown(connection.fd, SHUT_RDWR);
+        _numOfDropped++;
+    }
+
+    InferenceServer(const InferenceServer &);
+    InferenceServer &operator=(const InferenceServer &);
+
+    CompactDataset<FPType, Normalizer> _staging;
+    SharedPtr<TensorChunk<FPType> > _chunk;
+    prediction::Batch<FPType> _net;
+    SharedPtr<NativeLeNet<FPType> > _nativeNet;
+    std::vector<FPType> _probabilities;
+    size_t _maxBatchSize;
+    double _latencyBudget;
+
+    int _listenFd;
+    std::string _socketPath;
+    std::thread _acceptor;
+    std::mutex _connectionsMutex;
+    std::condition_variable _readersFinished;
+    std::set<int> _connections;
+    size_t _numOfReaders;
+
+    std::mutex _mutex;
+    std::condition_variable _arrived;
+    std::deque<Request> _pending;
+    /* Connections with unsent answers, only used by the serving thread */
+    std::vector<SharedPtr<Connection> > _unsentConnections;
+
+    LatencyStatistics _latencies;
+    size_t _numOfBatches;
+    size_t _numOfDropped;
+    double _servingTime;
+    std::chrono::steady_clock::time_point _firstRequest;
+    std::chrono::steady_clock::time_point _lastAnswer;
+};
+
+/* Blocking client of InferenceServer */
+class InferenceClient
+{
+public:
+
+    InferenceClient(const std::string &socketPath) : _fd(socket(AF_UNIX, SOCK_STREAM, 0))
+    {
+        sockaddr_un address = unixAddress(socketPath);
+        if (_fd < 0 || connect(_fd, (sockaddr *)&address, sizeof(address)) != 0)
+        {
+            if (_fd >= 0) { close(_fd); }
+            throw std::runtime_error("Unable to connect to socket " + socketPath);
+        }
+    }
+
+    ~InferenceClient() { close(_fd); }
+
+    InferenceResponse classify(const uint8_t *pixels, size_t size)
+    {
+        InferenceResponse response;
+        if (!sendAll(_fd, pixels, size) || !receiveAll(_fd, &response, sizeof(response)))
+        {
+            throw std::runtime_error("Connection to the inference server is lost");
+        }
+        return response;
+    }
+
+private:
+
+    InferenceClient(const InferenceClient &);
+    InferenceClient &operator=(const InferenceClient &);
+
+    int _fd;
+};
+
+#endif
@@ -0,0 +1,301 @@
+/* file: instrumentation.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Wall time of pipeline phases and LeNet layers, tensor allocations and resident memory,
+!    reported as JSON when the process exits
+!******************************************************************************/
+
+#ifndef _INSTRUMENTATION_H
+#define _INSTRUMENTATION_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "daal.h"
+
+using namespace daal;
+using namespace daal::algorithms;
+using namespace daal::algorithms::neural_networks;
+using namespace daal::services;
+using namespace daal::data_management;
+
+/* Largest resident set size of the process so far */
+inline size_t getPeakResidentBytes()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (size_t)usage.ru_maxrss * 1024;
+}
+
+inline size_t getResidentBytes()
+{
+    size_t pages = 0, residentPages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm)
+    {
+        if (fscanf(statm, "%lu %lu", (unsigned long *)&pages, (unsigned long *)&residentPages) != 2) { residentPages = 0; }
+        fclose(statm);
+    }
+    return residentPages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/* Process-wide collector of measurements. Recording is always on and costs a clock read and a lock
+   per phase, the report is written only if enable() was called.
+   Phases of background threads, e.g. chunk reads of the prefetcher, overlap the phases of the caller */
+class Profiler
+{
+public:
+
+    struct Phase
+    {
+        std::string name;
+        size_t count;
+        double seconds;
+        double maxSeconds;
+        /* Peak resident memory when the phase last finished, growth between phases points at the one that allocates */
+        size_t peakResidentBytes;
+    };
+
+    struct Layer
+    {
+        std::string model;
+        size_t index;
+        std::string name;
+        double forwardSeconds;
+        double backwardSeconds;
+        size_t parameterBytes;
+        size_t outputBytes;
+    };
+
+    struct Allocation
+    {
+        std::string name;
+        size_t count;
+        size_t bytes;
+    };
+
+    static Profiler &getInstance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    /* Writes the report to path at exit */
+    void enable(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_path.empty())
+        {
+            atexit(&Profiler::writeAtExit);
+        }
+        _path = path;
+    }
+
+    inline bool isEnabled() { return !_path.empty(); }
+
+    void addPhase(const char *name, double seconds)
+    {
+        size_t peakResidentBytes = getPeakResidentBytes();
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < _phases.size(); i++)
+        {
+            if (_phases[i].name == name)
+            {
+                _phases[i].count++;
+                _phases[i].seconds += seconds;
+                _phases[i].maxSeconds = std::max(_phases[i].maxSeconds, seconds);
+                _phases[i].peakResidentBytes = peakResidentBytes;
+                return;
+            }
+        }
+
+        Phase phase = { name, 1, seconds, seconds, peakResidentBytes };
+        _phases.push_back(phase);
+    }
+
+    void addAllocation(const char *name, size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < _allocations.size(); i++)
+        {
+            if (_allocations[i].name == name)
+            {
+                _allocations[i].count++;
+                _allocations[i].bytes += bytes;
+                return;
+            }
+        }
+
+        Allocation allocation = { name, 1, bytes };
+        _allocations.push_back(allocation);
+    }
+
+    void addLayer(const Layer &layer)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _layers.push_back(layer);
+    }
+
+    void writeReport()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_path.empty()) { return; }
+
+        FILE *report = fopen(_path.c_str(), "w");
+        if (!report)
+        {
+            fprintf(stderr, "Unable to write the profile to %s\n", _path.c_str());
+            return;
+        }
+
+        double totalSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+        fprintf(report, "{\n  \"totalSeconds\": %.6f,\n  \"peakResidentBytes\": %lu,\n  \"residentBytes\": %lu,\n",
+                totalSeconds, (unsigned long)getPeakResidentBytes(), (unsigned long)getResidentBytes());
+
+        fprintf(report, "  \"phases\": [");
+        for (size_t i = 0; i < _phases.size(); i++)
+        {
+            const Phase &p = _phases[i];
+            fprintf(report, "%s\n    { \"name\": \"%s\", \"count\": %lu, \"seconds\": %.6f, \"maxSeconds\": %.6f, \"peakResidentBytes\": %lu }",
+                    i ? "," : "", escape(p.name).c_str(), (unsigned long)p.count, p.seconds, p.maxSeconds,
+                    (unsigned long)p.peakResidentBytes);
+        }
+        fprintf(report, "\n  ],\n  \"layers\": [");
+        for (size_t i = 0; i < _layers.size(); i++)
+        {
+            const Layer &l = _layers[i];
+            fprintf(report, "%s\n    { \"model\": \"%s\", \"index\": %lu, \"name\": \"%s\", \"forwardSeconds\": %.6f, "
+                    "\"backwardSeconds\": %.6f, \"parameterBytes\": %lu, \"outputBytes\": %lu }",
+                    i ? "," : "", escape(l.model).c_str(), (unsigned long)l.index, escape(l.name).c_str(),
+                    l.forwardSeconds, l.backwardSeconds, (unsigned long)l.parameterBytes, (unsigned long)l.outputBytes);
+        }
+        fprintf(report, "\n  ],\n  \"allocations\": [");
+        for (size_t i = 0; i < _allocations.size(); i++)
+        {
+            const Allocation &a = _allocations[i];
+            fprintf(report, "%s\n    { \"name\": \"%s\", \"count\": %lu, \"bytes\": %lu }",
+                    i ? "," : "", escape(a.name).c_str(), (unsigned long)a.count, (unsigned long)a.bytes);
+        }
+        fprintf(report, "\n  ]\n}\n");
+        fclose(report);
+    }
+
+private:
+
+    Profiler() : _start(std::chrono::steady_clock::now()) { }
+
+    static void writeAtExit()
+    {
+        getInstance().writeReport();
+    }
+
+    static std::string escape(const std::string &value)
+    {
+        std::string escaped;
+        for (size_t i = 0; i < value.size(); i++)
+        {
+            if (value[i] == '"' || value[i] == '\\') { escaped += '\\'; }
+            escaped += value[i];
+        }
+        return escaped;
+    }
+
+    std::mutex _mutex;
+    std::string _path;
+    std::chrono::steady_clock::time_point _start;
+    std::vector<Phase> _phases;
+    std::vector<Layer> _layers;
+    std::vector<Allocation> _allocations;
+};
+
+/* Adds the lifetime of the object to a phase */
+class ScopedPhase
+{
+public:
+    ScopedPhase(const char *name) : _name(name), _start(std::chrono::steady_clock::now()) { }
+
+    ~ScopedPhase()
+    {
+        Profiler::getInstance().addPhase(_name, std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count());
+    }
+
+private:
+    const char *_name;
+    std::chrono::steady_clock::time_point _start;
+};
+
+inline size_t getTensorBytes(const TensorPtr &tensor, size_t typeSize)
+{
+    return tensor ? tensor->getSize() * typeSize : 0;
+}
+
+/* Per-layer times of a model measured by running its layers one by one, repetitions times each,
+   on the inputs the last compute() of the whole network left in them. DAAL runs the layers of a
+   network inside one call, so this is the only place their individual cost can be observed.
+   layerNames are the names of the layers in the order of the topology, missing ones are numbered */
+template<typename FPType>
+void profileLayers(const std::string &model, const std::vector<std::string> &layerNames,
+                   const SharedPtr<ForwardLayers> &forwardLayers, const SharedPtr<BackwardLayers> &backwardLayers,
+                   size_t repetitions = 5)
+{
+    if (!forwardLayers) { return; }
+    repetitions = std::max<size_t>(repetitions, 1);
+
+    for (size_t i = 0; i < forwardLayers->size(); i++)
+    {
+        Profiler::Layer layer;
+        layer.model = model;
+        layer.index = i;
+        if (i < layerNames.size())
+        {
+            layer.name = layerNames[i];
+        }
+        else
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "layer%lu", (unsigned long)(i + 1));
+            layer.name = name;
+        }
+
+        layers::forward::Input *input = forwardLayers->get(i)->getLayerInput();
+        layer.parameterBytes = getTensorBytes(input->get(layers::forward::weights), sizeof(FPType)) +
+                               getTensorBytes(input->get(layers::forward::biases), sizeof(FPType));
+        layer.outputBytes = getTensorBytes(forwardLayers->get(i)->getLayerResult()->get(layers::forward::value), sizeof(FPType));
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < repetitions; r++)
+        {
+            forwardLayers->get(i)->compute();
+        }
+        layer.forwardSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repetitions;
+
+        layer.backwardSeconds = 0;
+        if (backwardLayers && i < backwardLayers->size())
+        {
+            start = std::chrono::steady_clock::now();
+            for (size_t r = 0; r < repetitions; r++)
+            {
+                backwardLayers->get(i)->compute();
+            }
+            layer.backwardSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repetitions;
+        }
+
+        Profiler::getInstance().addLayer(layer);
+    }
+}
+
+#endif
@@ -0,0 +1,273 @@
+/* file: lenet_infer.cpp */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Inference-only LeNet: maps a model saved by daal_lenet.exe --save-model and tests it,
+!    serves it over a Unix socket or puts load on such a server
+!******************************************************************************/
+
+#include "lenet_pipeline.h"
+#include "model_file.h"
+#include "inference_server.h"
+#include "service.h"
+#include <chrono>
+#include <thread>
+#include <csignal>
+
+template<typename FPType> int runInference();
+template<typename FPType> prediction::TopologyPtr configureTopology();
+template<typename FPType> int runServer();
+int runClients();
+
+size_t TestDataCount = 10000;
+bool PrintClasses = false;
+/* Predict with the fused native network instead of prediction::Batch */
+bool NativeInference = false;
+/* Predict both ways and compare the results */
+bool CheckNative = false;
+/* Topology file the model was trained with, empty loads LeNet */
+string TopologyPath;
+/* Test accuracy runInference requires */
+double MinAccuracy = 0.9;
+
+/* Serve the model on this socket instead of testing it */
+string ServerSocket;
+size_t MaxBatchSize = 64;
+/* Milliseconds the oldest queued request may wait for more requests to join its batch */
+double LatencyBudget = 2;
+
+/* Send the test images to a server on this socket instead of loading the model */
+string ClientSocket;
+size_t NumberOfClients = 8;
+
+volatile sig_atomic_t Interrupted = 0;
+
+void interrupt(int)
+{
+    Interrupted = 1;
+}
+
+string fileNames[] =
+{
+    "./lenet.model",
+    "./data/t10k-images-idx3-ubyte",
+    "./data/t10k-labels-idx1-ubyte"
+};
+
+inline double secondsSince(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    TestDataCount = getSizeOption(argc, argv, "test-count", TestDataCount, 1);
+    PrintClasses = getFlagOption(argc, argv, "print-classes");
+    NativeInference = getFlagOption(argc, argv, "native");
+    CheckNative = getFlagOption(argc, argv, "check-native");
+    ServerSocket = getStringOption(argc, argv, "serve", ServerSocket);
+    MaxBatchSize = getSizeOption(argc, argv, "max-batch", MaxBatchSize, 1);
+    LatencyBudget = getDoubleOption(argc, argv, "latency-budget", LatencyBudget);
+    ClientSocket = getStringOption(argc, argv, "connect", ClientSocket);
+    NumberOfClients = getSizeOption(argc, argv, "clients", NumberOfClients, 1);
+    TopologyPath = getStringOption(argc, argv, "topology", TopologyPath);
+    MinAccuracy = getDoubleOption(argc, argv, "min-accuracy", MinAccuracy);
+
+    checkArguments(argc, argv, 3, &fileNames[0], &fileNames[1], &fileNames[2]);
+
+    if (!ClientSocket.empty())
+    {
+        return runClients();
+    }
+
+    ModelFileHeader header = readModelFileHeader(fileNames[0]);
+    if (header.typeSize == sizeof(float))
+    {
+        return ServerSocket.empty() ? runInference<float>() : runServer<float>();
+    }
+    return ServerSocket.empty() ? runInference<double>() : runServer<double>();
+}
+
+template<typename FPType>
+prediction::TopologyPtr configureTopology()
+{
+    TopologyConfig topology = TopologyPath.empty() ? TopologyConfig::lenet() : TopologyConfig::load(TopologyPath);
+    return topology.template buildPrediction<FPType>();
+}
+
+/*The native network has compile-time sizes of 28x28 objects without margins*/
+template<typename FPType>
+SharedPtr<NativeLeNet<FPType> > loadNativeNet(ModelFile<FPType> &modelFile, const prediction::ModelPtr &model)
+{
+    const ModelFileHeader &header = modelFile.getHeader();
+    if (header.objectDims[0] != 1 || header.objectDims[1] != 28 || header.objectDims[2] != 28)
+    {
+        throw std::runtime_error("Native LeNet supports 1x28x28 objects only");
+    }
+    return SharedPtr<NativeLeNet<FPType> >(new NativeLeNet<FPType>(model));
+}
+
+template<typename FPType>
+int runInference()
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    ModelFile<FPType> modelFile(fileNames[0]);
+    prediction::ModelPtr model = modelFile.load(configureTopology<FPType>());
+    SharedPtr<NativeLeNet<FPType> > nativeNet;
+    if (NativeInference || CheckNative)
+    {
+        nativeNet = loadNativeNet<FPType>(modelFile, model);
+    }
+    double modelTime = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    DatasetReader_MNIST<FPType> reader;
+    reader.setTestBatch(fileNames[1], fileNames[2], TestDataCount);
+    reader.read();
+    double loadTime = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    prediction::ResultPtr result = NativeInference ? predictNative(*nativeNet, reader.getTestData())
+                                                   : predict<FPType>(model, reader.getTestData());
+    double predictTime = secondsSince(start);
+
+    if (CheckNative)
+    {
+        start = std::chrono::steady_clock::now();
+        prediction::ResultPtr otherResult = NativeInference ? predict<FPType>(model, reader.getTestData())
+                                                            : predictNative(*nativeNet, reader.getTestData());
+        double otherTime = secondsSince(start);
+
+        double maxDifference, agreement;
+        comparePredictions<FPType>(result->get(prediction::prediction), otherResult->get(prediction::prediction),
+                                   maxDifference, agreement);
+        printf("prediction::Batch %.3f ms, native %.3f ms, max probability difference %.3g, same class for %.2f%% of images\n",
+               (NativeInference ? otherTime : predictTime) * 1000, (NativeInference ? predictTime : otherTime) * 1000,
+               maxDifference, 100.0 * agreement);
+    }
+
+    if (PrintClasses)
+    {
+        printPredictedClasses<FPType>(result, reader.getTestGroundTruth());
+    }
+
+    double accuracy = computeAccuracy<FPType>(result, reader.getTestGroundTruth());
+    printf("Model mapped in %.3f ms, %lu test images loaded in %.3f ms, predicted in %.3f ms (%.0f images/s)\n",
+           modelTime * 1000, (unsigned long)TestDataCount, loadTime * 1000, predictTime * 1000,
+           TestDataCount / predictTime);
+    printf("Accuracy %.4f\n", accuracy);
+
+    return accuracy > MinAccuracy ? 0 : -1;
+}
+
+/*Answer requests until SIGINT or SIGTERM, then report the latencies measured by the server*/
+template<typename FPType>
+int runServer()
+{
+    ModelFile<FPType> modelFile(fileNames[0]);
+    prediction::ModelPtr model = modelFile.load(configureTopology<FPType>());
+
+    const ModelFileHeader &header = modelFile.getHeader();
+    const size_t imageSize = 28;
+    if (header.objectDims[1] < imageSize || header.objectDims[2] != header.objectDims[1] ||
+        (header.objectDims[1] - imageSize) % 2 != 0)
+    {
+        throw std::runtime_error("The server answers 28x28 images, the model needs objects of 28x28 with equal margins");
+    }
+    size_t margin = (header.objectDims[1] - imageSize) / 2;
+
+    InferenceServer<FPType> server(model, imageSize, imageSize, margin, MaxBatchSize, LatencyBudget / 1000);
+    if (NativeInference)
+    {
+        server.setNativeNet(loadNativeNet<FPType>(modelFile, model));
+    }
+
+    signal(SIGINT, interrupt);
+    signal(SIGTERM, interrupt);
+
+    server.start(ServerSocket);
+    printf("Serving on %s, batches of up to %lu requests, latency budget %.3f ms\n",
+           ServerSocket.c_str(), (unsigned long)MaxBatchSize, LatencyBudget);
+    fflush(stdout);
+
+    server.serve(Interrupted);
+    server.stop();
+
+    server.getLatencies().print("Server", server.getActiveTime());
+    size_t numOfBatches = server.getNumberOfBatches();
+    printf("%lu batches, %.1f requests per batch, %.3f s spent in prediction, %lu clients dropped for not reading answers\n",
+           (unsigned long)numOfBatches, numOfBatches ? (double)server.getLatencies().size() / numOfBatches : 0.0,
+           server.getServingTime(), (unsigned long)server.getNumberOfDropped());
+    return 0;
+}
+
+/*Closed-loop load: every client sends its next test image as soon as the previous answer arrives*/
+int runClients()
+{
+    DatasetReader_MNIST<float> reader;
+    SharedPtr<CompactDataset<float> > images = reader.readCompactBatch(fileNames[1], fileNames[2], TestDataCount);
+
+    const size_t numOfImages = images->getNumberOfObjects();
+    const size_t imageSize = images->getObjectSize();
+    std::vector<LatencyStatistics> latencies(NumberOfClients);
+    std::vector<size_t> numOfCorrect(NumberOfClients, 0);
+    std::vector<std::string> errors(NumberOfClients);
+    std::vector<std::thread> clients;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t c = 0; c < NumberOfClients; c++)
+    {
+        clients.push_back(std::thread([&, c]
+        {
+            /* An exception leaving the thread would terminate the process, it is reported after the join */
+            try
+            {
+                InferenceClient client(ClientSocket);
+                for (size_t i = c; i < numOfImages; i += NumberOfClients)
+                {
+                    std::chrono::steady_clock::time_point sent = std::chrono::steady_clock::now();
+                    InferenceResponse response = client.classify(images->getPixels() + i * imageSize, imageSize);
+                    latencies[c].add(secondsSince(sent));
+                    numOfCorrect[c] += (response.label == images->getLabels()[i]);
+                }
+            }
+            catch (std::exception &e)
+            {
+                errors[c] = e.what();
+            }
+        }));
+    }
+    for (size_t c = 0; c < NumberOfClients; c++)
+    {
+        clients[c].join();
+    }
+    double elapsedTime = secondsSince(start);
+
+    LatencyStatistics total;
+    size_t correct = 0;
+    size_t numOfFailed = 0;
+    for (size_t c = 0; c < NumberOfClients; c++)
+    {
+        total.merge(latencies[c]);
+        correct += numOfCorrect[c];
+        if (!errors[c].empty())
+        {
+            printf("Client %lu failed: %s\n", (unsigned long)c, errors[c].c_str());
+            numOfFailed++;
+        }
+    }
+
+    printf("%lu clients\n", (unsigned long)NumberOfClients);
+    total.print("Clients", elapsedTime);
+    printf("Accuracy %.4f on %lu answered requests\n", total.size() ? (double)correct / total.size() : 0.0,
+           (unsigned long)total.size());
+    return numOfFailed > 0 ? -1 : 0;
+}
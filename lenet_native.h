@@ -0,0 +1,381 @@
+/* file: lenet_native.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Fused forward pass of the LeNet topology of configureNet with compile-time layer sizes
+!******************************************************************************/
+
+#ifndef _LENET_NATIVE_H
+#define _LENET_NATIVE_H
+
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include "daal.h"
+#include "simd.h"
+#include "tensor_pool.h"
+
+using namespace daal;
+using namespace daal::algorithms;
+using namespace daal::algorithms::neural_networks;
+using namespace daal::services;
+using namespace daal::data_management;
+
+/* LeNet inference without layer dispatch or full intermediate tensors:
+   conv 3x3/32 + max pool 2x2 and conv 5x5/64 + max pool 2x2 are fused per pooled pixel,
+   FC256 + ReLU and FC10 + softmax run per block of objects.
+   Activations are kept channel-last and the weights are repacked once, so that every kernel
+   accumulates 2 vectors of output channels for 4 pooling positions or 4 objects in registers
+   while it streams contiguous weights */
+template<typename FPType, size_t ImageSize = 28>
+class NativeLeNet
+{
+public:
+
+    static const size_t K1 = 32;                        /* conv1 kernels */
+    static const size_t R1 = 3;                         /* conv1 kernel size */
+    static const size_t P1 = (ImageSize - R1 + 1) / 2;  /* pool1 output size */
+    static const size_t K2 = 64;
+    static const size_t R2 = 5;
+    static const size_t P2 = (P1 - R2 + 1) / 2;
+    static const size_t N3 = K2 * P2 * P2;              /* FC256 inputs */
+    static const size_t F3 = 256;
+    static const size_t F4 = 10;
+    /* Objects that share one pass over the FC weights, a multiple of 4 */
+    static const size_t BLOCK = 16;
+
+    /* Layer indices of TopologyConfig::lenet() */
+    NativeLeNet(const prediction::ModelPtr &model)
+    {
+        SharedPtr<ForwardLayers> forwardLayers = model->getLayers();
+        if (forwardLayers->size() < 8)
+        {
+            throw std::runtime_error("Model does not have the LeNet topology");
+        }
+
+        std::vector<FPType> w;
+
+        /* Convolutions: [k][c][ky][kx] to [ky][kx][c][k] */
+        readLayer(forwardLayers, 0, K1, K1 * R1 * R1, w, _b1);
+        _w1.resize(w.size());
+        for (size_t k = 0; k < K1; k++)
+        {
+            for (size_t r = 0; r < R1 * R1; r++)
+            {
+                _w1[r * K1 + k] = w[k * R1 * R1 + r];
+            }
+        }
+
+        readLayer(forwardLayers, 2, K2, K2 * K1 * R2 * R2, w, _b2);
+        _w2.resize(w.size());
+        for (size_t k = 0; k < K2; k++)
+        {
+            for (size_t c = 0; c < K1; c++)
+            {
+                for (size_t r = 0; r < R2 * R2; r++)
+                {
+                    _w2[(r * K1 + c) * K2 + k] = w[(k * K1 + c) * R2 * R2 + r];
+                }
+            }
+        }
+
+        /* FC256: [j][c][p] to [j / GROUP][p][c][j % GROUP], DAAL flattens the input as CHW and it is HWC here */
+        readLayer(forwardLayers, 4, F3, F3 * N3, w, _b3);
+        _w3.resize(w.size());
+        for (size_t j = 0; j < F3; j++)
+        {
+            for (size_t c = 0; c < K2; c++)
+            {
+                for (size_t p = 0; p < P2 * P2; p++)
+                {
+                    _w3[((j / GROUP) * N3 + p * K2 + c) * GROUP + j % GROUP] = w[j * N3 + c * P2 * P2 + p];
+                }
+            }
+        }
+
+        /* FC10: [j][i] to [i][j] */
+        readLayer(forwardLayers, 6, F4, F4 * F3, w, _b4);
+        _w4.resize(w.size());
+        for (size_t j = 0; j < F4; j++)
+        {
+            for (size_t i = 0; i < F3; i++)
+            {
+                _w4[i * F4 + j] = w[j * F3 + i];
+            }
+        }
+    }
+
+    /* images: n x 1 x ImageSize x ImageSize, probabilities: n x 10 */
+    void forward(const FPType *images, size_t n, FPType *probabilities) const
+    {
+        const size_t nBlocks = (n + BLOCK - 1) / BLOCK;
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, nBlocks), [&](const tbb::blocked_range<size_t> &range)
+        {
+            std::vector<FPType> pooled1(P1 * P1 * K1);
+            std::vector<FPType> pooled2(BLOCK * N3);
+            std::vector<FPType> hidden(BLOCK * F3);
+
+            for (size_t block = range.begin(); block < range.end(); block++)
+            {
+                const size_t first = block * BLOCK;
+                const size_t count = std::min(BLOCK, n - first);
+
+                for (size_t i = 0; i < count; i++)
+                {
+                    convolutionPool<ImageSize, 1, K1, R1>(images + (first + i) * ImageSize * ImageSize,
+                                                          &_w1[0], &_b1[0], &pooled1[0]);
+                    convolutionPool<P1, K1, K2, R2>(&pooled1[0], &_w2[0], &_b2[0], &pooled2[i * N3]);
+                }
+
+                /* FC256 works on groups of 4 objects, the tail of the last group is computed on zeros */
+                const size_t paddedCount = (count + 3) / 4 * 4;
+                std::fill(pooled2.begin() + count * N3, pooled2.begin() + paddedCount * N3, (FPType)0);
+
+                fullyConnectedRelu3(&pooled2[0], paddedCount, &hidden[0]);
+                fullyConnectedSoftmax4(&hidden[0], count, probabilities + first * F4);
+            }
+        });
+    }
+
+    /* Same input and output as prediction::Batch on the LeNet prediction model */
+    TensorPtr predict(const TensorPtr &data) const
+    {
+        const Collection<size_t> &dims = data->getDimensions();
+        if (dims.size() != 4 || dims[1] != 1 || dims[2] != ImageSize || dims[3] != ImageSize)
+        {
+            throw std::runtime_error("Native LeNet got objects of unsupported shape");
+        }
+
+        const size_t n = dims[0];
+        Collection<size_t> resultDims;
+        resultDims.push_back(n);
+        resultDims.push_back(F4);
+        SharedPtr<HomogenTensor<FPType> > result = makePooledTensor<FPType>(resultDims);
+
+        SubtensorDescriptor<FPType> block;
+        data->getSubtensor(0, 0, 0, n, readOnly, block);
+        forward(block.getPtr(), n, result->getArray());
+        data->releaseSubtensor(block);
+
+        return result;
+    }
+
+    /* Weights and biases of a layer of the model, checked against the LeNet sizes */
+    static void readLayer(const SharedPtr<ForwardLayers> &forwardLayers, size_t index, size_t nOutputs, size_t size,
+                          std::vector<FPType> &weights, std::vector<FPType> &biases)
+    {
+        layers::forward::Input *input = forwardLayers->get(index)->getLayerInput();
+        readTensor(input->get(layers::forward::weights), nOutputs, size, weights);
+        readTensor(input->get(layers::forward::biases), nOutputs, nOutputs, biases);
+    }
+
+    static void readTensor(const TensorPtr &tensor, size_t firstDimension, size_t size, std::vector<FPType> &values)
+    {
+        if (!tensor || tensor->getSize() != size || tensor->getDimensionSize(0) != firstDimension)
+        {
+            throw std::runtime_error("Model does not have the LeNet topology");
+        }
+
+        SubtensorDescriptor<FPType> block;
+        tensor->getSubtensor(0, 0, 0, firstDimension, readOnly, block);
+        values.assign(block.getPtr(), block.getPtr() + size);
+        tensor->releaseSubtensor(block);
+    }
+
+private:
+
+    typedef Simd<FPType> S;
+    typedef typename S::Vector Vector;
+
+    /* Output channels accumulated together, two vectors */
+    static const size_t GROUP = 2 * S::width;
+
+    /* Convolution with unit strides and no padding followed by 2x2 max pooling with stride 2.
+       input: In x In x C, weights: R x R x C x K, pooled: Out x Out x K.
+       The bias is the same for the whole pooling window, so it is added after the maximum */
+    template<size_t In, size_t C, size_t K, size_t R>
+    static void convolutionPool(const FPType *input, const FPType *weights, const FPType *biases, FPType *pooled)
+    {
+        const size_t V = S::width;
+        const size_t Out = (In - R + 1) / 2;
+
+        for (size_t py = 0; py < Out; py++)
+        {
+            for (size_t px = 0; px < Out; px++)
+            {
+                for (size_t k = 0; k < K; k += GROUP)
+                {
+                    /* Accumulators of the 4 positions of the pooling window, unrolled to stay in registers */
+                    Vector a00 = S::zero(), a01 = S::zero(), a10 = S::zero(), a11 = S::zero();
+                    Vector a20 = S::zero(), a21 = S::zero(), a30 = S::zero(), a31 = S::zero();
+
+                    for (size_t ky = 0; ky < R; ky++)
+                    {
+                        for (size_t kx = 0; kx < R; kx++)
+                        {
+                            const FPType *w = weights + (ky * R + kx) * C * K + k;
+                            const FPType *s0 = input + ((2 * py + ky) * In + 2 * px + kx) * C;
+                            const FPType *s1 = s0 + C;
+                            const FPType *s2 = s0 + In * C;
+                            const FPType *s3 = s2 + C;
+                            for (size_t c = 0; c < C; c++)
+                            {
+                                const Vector w0 = S::load(w + c * K);
+                                const Vector w1 = S::load(w + c * K + V);
+                                Vector x;
+                                x = S::set1(s0[c]); a00 = S::add(a00, S::mul(x, w0)); a01 = S::add(a01, S::mul(x, w1));
+                                x = S::set1(s1[c]); a10 = S::add(a10, S::mul(x, w0)); a11 = S::add(a11, S::mul(x, w1));
+                                x = S::set1(s2[c]); a20 = S::add(a20, S::mul(x, w0)); a21 = S::add(a21, S::mul(x, w1));
+                                x = S::set1(s3[c]); a30 = S::add(a30, S::mul(x, w0)); a31 = S::add(a31, S::mul(x, w1));
+                            }
+                        }
+                    }
+
+                    FPType *dst = pooled + (py * Out + px) * K + k;
+                    S::store(dst,     S::add(S::max(S::max(a00, a10), S::max(a20, a30)), S::load(biases + k)));
+                    S::store(dst + V, S::add(S::max(S::max(a01, a11), S::max(a21, a31)), S::load(biases + k + V)));
+                }
+            }
+        }
+    }
+
+    /* count is a multiple of 4. Every group of weights is streamed once per 4 objects */
+    void fullyConnectedRelu3(const FPType *input, size_t count, FPType *hidden) const
+    {
+        const size_t V = S::width;
+
+        for (size_t b = 0; b < count; b += 4)
+        {
+            const FPType *x0 = input + b * N3;
+            const FPType *x1 = x0 + N3;
+            const FPType *x2 = x1 + N3;
+            const FPType *x3 = x2 + N3;
+
+            for (size_t j = 0; j < F3; j += GROUP)
+            {
+                const Vector bias0 = S::load(&_b3[j]);
+                const Vector bias1 = S::load(&_b3[j + V]);
+                Vector a00 = bias0, a01 = bias1, a10 = bias0, a11 = bias1;
+                Vector a20 = bias0, a21 = bias1, a30 = bias0, a31 = bias1;
+
+                const FPType *w = &_w3[(j / GROUP) * N3 * GROUP];
+                for (size_t i = 0; i < N3; i++)
+                {
+                    const Vector w0 = S::load(w + i * GROUP);
+                    const Vector w1 = S::load(w + i * GROUP + V);
+                    Vector x;
+                    x = S::set1(x0[i]); a00 = S::add(a00, S::mul(x, w0)); a01 = S::add(a01, S::mul(x, w1));
+                    x = S::set1(x1[i]); a10 = S::add(a10, S::mul(x, w0)); a11 = S::add(a11, S::mul(x, w1));
+                    x = S::set1(x2[i]); a20 = S::add(a20, S::mul(x, w0)); a21 = S::add(a21, S::mul(x, w1));
+                    x = S::set1(x3[i]); a30 = S::add(a30, S::mul(x, w0)); a31 = S::add(a31, S::mul(x, w1));
+                }
+
+                FPType *h = hidden + b * F3 + j;
+                S::store(h,              S::max(a00, S::zero())); S::store(h + V,              S::max(a01, S::zero()));
+                S::store(h + F3,         S::max(a10, S::zero())); S::store(h + F3 + V,         S::max(a11, S::zero()));
+                S::store(h + 2 * F3,     S::max(a20, S::zero())); S::store(h + 2 * F3 + V,     S::max(a21, S::zero()));
+                S::store(h + 3 * F3,     S::max(a30, S::zero())); S::store(h + 3 * F3 + V,     S::max(a31, S::zero()));
+            }
+        }
+    }
+
+    void fullyConnectedSoftmax4(const FPType *hidden, size_t count, FPType *probabilities) const
+    {
+        for (size_t b = 0; b < count; b++)
+        {
+            FPType *out = probabilities + b * F4;
+            std::copy(_b4.begin(), _b4.end(), out);
+            for (size_t i = 0; i < F3; i++)
+            {
+                const FPType x = hidden[b * F3 + i];
+                const FPType *w = &_w4[i * F4];
+                for (size_t j = 0; j < F4; j++)
+                {
+                    out[j] += x * w[j];
+                }
+            }
+
+            const FPType maxValue = *std::max_element(out, out + F4);
+            FPType sum = 0;
+            for (size_t j = 0; j < F4; j++)
+            {
+                out[j] = std::exp(out[j] - maxValue);
+                sum += out[j];
+            }
+            for (size_t j = 0; j < F4; j++)
+            {
+                out[j] /= sum;
+            }
+        }
+    }
+
+    std::vector<FPType> _w1, _b1;
+    std::vector<FPType> _w2, _b2;
+    std::vector<FPType> _w3, _b3;
+    std::vector<FPType> _w4, _b4;
+};
+
+template<typename FPType, size_t ImageSize> const size_t NativeLeNet<FPType, ImageSize>::K1;
+template<typename FPType, size_t ImageSize> const size_t NativeLeNet<FPType, ImageSize>::R1;
+template<typename FPType, size_t ImageSize> const size_t NativeLeNet<FPType, ImageSize>::P1;
+template<typename FPType, size_t ImageSize> const size_t NativeLeNet<FPType, ImageSize>::K2;
+template<typename FPType, size_t ImageSize> const size_t NativeLeNet<FPType, ImageSize>::R2;
+template<typename FPType, size_t ImageSize> const size_t NativeLeNet<FPType, ImageSize>::P2;
+template<typename FPType, size_t ImageSize> const size_t NativeLeNet<FPType, ImageSize>::N3;
+template<typename FPType, size_t ImageSize> const size_t NativeLeNet<FPType, ImageSize>::F3;
+template<typename FPType, size_t ImageSize> const size_t NativeLeNet<FPType, ImageSize>::F4;
+template<typename FPType, size_t ImageSize> const size_t NativeLeNet<FPType, ImageSize>::BLOCK;
+template<typename FPType, size_t ImageSize> const size_t NativeLeNet<FPType, ImageSize>::GROUP;
+
+/* Prediction result of the native network, interchangeable with the one of prediction::Batch */
+template<typename FPType, size_t ImageSize>
+prediction::ResultPtr predictNative(const NativeLeNet<FPType, ImageSize> &nativeNet, const TensorPtr &data)
+{
+    prediction::ResultPtr result(new prediction::Result());
+    result->set(prediction::prediction, nativeNet.predict(data));
+    return result;
+}
+
+/* Largest difference between the probabilities of two predictions and the share of objects
+   whose most probable class is the same */
+template<typename FPType>
+void comparePredictions(const TensorPtr &expected, const TensorPtr &actual, double &maxDifference, double &agreement)
+{
+    const size_t n = expected->getDimensionSize(0);
+    const size_t nClasses = expected->getDimensionSize(1);
+
+    SubtensorDescriptor<FPType> expectedBlock, actualBlock;
+    expected->getSubtensor(0, 0, 0, n, readOnly, expectedBlock);
+    actual->getSubtensor(0, 0, 0, n, readOnly, actualBlock);
+    const FPType *e = expectedBlock.getPtr();
+    const FPType *a = actualBlock.getPtr();
+
+    maxDifference = 0;
+    size_t sameClass = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        for (size_t j = 0; j < nClasses; j++)
+        {
+            maxDifference = std::max(maxDifference, (double)std::fabs(e[i * nClasses + j] - a[i * nClasses + j]));
+        }
+        sameClass += (std::max_element(e + i * nClasses, e + (i + 1) * nClasses) - (e + i * nClasses)) ==
+                     (std::max_element(a + i * nClasses, a + (i + 1) * nClasses) - (a + i * nClasses));
+    }
+    agreement = n ? (double)sameClass / n : 1.0;
+
+    expected->releaseSubtensor(expectedBlock);
+    actual->releaseSubtensor(actualBlock);
+}
+
+#endif
@@ -0,0 +1,585 @@
+/* file: lenet_pipeline.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    LeNet training and prediction steps shared by the sample and the benchmarks
+!******************************************************************************/
+
+#ifndef _LENET_PIPELINE_H
+#define _LENET_PIPELINE_H
+
+#include "image_dataset.h"
+#include "batch_pipeline.h"
+#include "instrumentation.h"
+#include "evaluation.h"
+#include "topology_config.h"
+#include "checkpoint.h"
+#include "augmentation.h"
+#include "validation.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+struct TrainingParameters
+{
+    size_t batchSize;
+    double learningRate;
+    /* learningRate was set by the user, otherwise a resumed run continues with the rate of its checkpoint */
+    bool learningRateGiven;
+    /* Streaming training reads this many minibatches at a time instead of the whole train set */
+    size_t batchesPerChunk;
+    /* Chunk buffers filled in the background while the network computes, 0 reads synchronously */
+    size_t prefetchBuffers;
+    size_t numberOfEpochs;
+    /* Reorder the train objects with a new permutation before every epoch */
+    bool shuffle;
+    uint64_t seed;
+    /* Train objects used to measure loss and accuracy after every epoch, 0 disables the measurement */
+    size_t probeSize;
+    /* Print statistics of every epoch */
+    bool verbose;
+    /* Topology read from a file, empty trains the one of configureNet or TopologyConfig::lenet() */
+    SharedPtr<TopologyConfig> topology;
+    /* Builds the topology when no file is given, e.g. configureNet of the sample, NULL builds TopologyConfig::lenet() */
+    training::TopologyPtr (*configureNet)();
+    /* Directory of training checkpoints, empty disables them */
+    std::string checkpointDirectory;
+    /* Chunks between checkpoints, one is also written after every epoch. 0 writes none, e.g. on the
+       replicas of data-parallel training that resume from the checkpoints of rank 0 */
+    size_t checkpointInterval;
+    /* Continue from the newest complete checkpoint of checkpointDirectory */
+    bool resume;
+    /* Random transformations of the train objects, seeded with seed */
+    AugmentationParameters augmentation;
+    /* Validation on held-out train objects during the training and early stopping */
+    ValidationParameters validation;
+
+    TrainingParameters() : batchSize(10), learningRate(0.01), learningRateGiven(false), batchesPerChunk(100), prefetchBuffers(2),
+        numberOfEpochs(1), shuffle(false), seed(777), probeSize(1000), verbose(true), configureNet(NULL),
+        checkpointInterval(0), resume(false) { }
+};
+
+/* Description of the topology the parameters train, e.g. for the names and shapes of its layers */
+inline TopologyConfig getTopologyConfig(const TrainingParameters &parameters)
+{
+    return parameters.topology ? *parameters.topology : TopologyConfig::lenet();
+}
+
+template<typename FPType>
+training::TopologyPtr configureTopology(const TrainingParameters &parameters)
+{
+    if (parameters.topology)
+    {
+        return parameters.topology->template buildTraining<FPType>();
+    }
+    return parameters.configureNet ? parameters.configureNet() : TopologyConfig::lenet().template buildTraining<FPType>();
+}
+
+struct EpochStatistics
+{
+    size_t epoch;
+    double time;
+    double stallTime;
+    double loss;
+    double accuracy;
+};
+
+/* Hooks into the training loop of trainModelStreaming */
+class TrainingListener
+{
+public:
+    virtual ~TrainingListener() { }
+
+    /* After every chunk of minibatches */
+    virtual void chunkTrained(const training::ModelPtr & /* model */, size_t /* epoch */, size_t /* chunk */) { }
+    /* After the last chunk of an epoch, before the model is evaluated */
+    virtual void epochTrained(const training::ModelPtr & /* model */, size_t /* epoch */) { }
+    /* After the model is evaluated, returning false stops the training */
+    virtual bool epochFinished(const training::ModelPtr & /* model */, const EpochStatistics & /* statistics */) { return true; }
+};
+
+template<typename FPType>
+prediction::ResultPtr predict(const prediction::ModelPtr &predictionModel, const TensorPtr &testingData);
+template<typename FPType>
+double computeAccuracy(const prediction::ResultPtr &predictionResult, const TensorPtr &testingGroundTruth);
+template<typename FPType>
+double computeLoss(const prediction::ResultPtr &predictionResult, const TensorPtr &testingGroundTruth);
+
+/*Per-layer times of the trained network on its last minibatch, only when a profile is written*/
+template<typename FPType>
+void profileTraining(const training::ModelPtr &model, const TrainingParameters &parameters)
+{
+    if (Profiler::getInstance().isEnabled())
+    {
+        profileLayers<FPType>("training", getTopologyConfig(parameters).getLayerNames(), model->getForwardLayers(),
+                              model->getBackwardLayers());
+    }
+}
+
+template<typename FPType>
+void configureTraining(training::Batch<FPType> &net, const TrainingParameters &parameters)
+{
+    SharedPtr<optimization_solver::sgd::Batch<FPType> > sgdAlgorithm(new optimization_solver::sgd::Batch<FPType>());
+    (*(HomogenNumericTable<double>::cast(sgdAlgorithm->parameter.learningRateSequence)))[0][0] = parameters.learningRate;
+
+    net.parameter.batchSize = parameters.batchSize;
+    net.parameter.optimizationSolver = sgdAlgorithm;
+}
+
+/*Objects of the dataset from firstObject on, evaluated after every epoch*/
+template<typename FPType>
+SharedPtr<TensorChunk<FPType> > readProbe(DatasetChunkReader<FPType> &reader, size_t probeSize, size_t firstObject = 0)
+{
+    probeSize = std::min(probeSize, reader.getNumberOfObjects() - std::min(firstObject, reader.getNumberOfObjects()));
+    if (probeSize == 0)
+    {
+        return SharedPtr<TensorChunk<FPType> >();
+    }
+
+    SharedPtr<TensorChunk<FPType> > probe(new TensorChunk<FPType>(reader.getObjectDimensions(), probeSize));
+    std::vector<size_t> indices(probeSize);
+    for (size_t i = 0; i < probeSize; i++)
+    {
+        indices[i] = firstObject + i;
+    }
+    reader.readObjects(&indices[0], probeSize, probe->data->getArray(), probe->groundTruth->getArray());
+    probe->numOfObjects = probeSize;
+    return probe;
+}
+
+/*LeNet training on chunks of minibatches read on demand, memory does not depend on the dataset size*/
+template<typename FPType>
+prediction::ModelPtr trainModelStreaming(DatasetChunkReader<FPType> &reader, const TrainingParameters &parameters,
+                                         std::vector<EpochStatistics> *statistics = NULL,
+                                         TrainingListener *listener = NULL)
+{
+    if (parameters.batchSize == 0 || parameters.batchesPerChunk == 0)
+    {
+        throw std::runtime_error("Streaming training needs at least one object per minibatch and one minibatch per chunk");
+    }
+
+    training::TopologyPtr topology = configureTopology<FPType>(parameters);
+
+    training::Batch<FPType> net;
+    configureTraining(net, parameters);
+
+    /* The last objects are held out of the training and validated on in the background */
+    SharedPtr<DatasetShard<FPType> > trainShard;
+    SharedPtr<AsyncValidator<FPType> > validator;
+    if (parameters.validation.isEnabled())
+    {
+        if (parameters.validation.holdoutSize >= reader.getNumberOfObjects())
+        {
+            throw std::runtime_error("Validation holdout leaves no objects to train on");
+        }
+        const size_t numOfTrainObjects = reader.getNumberOfObjects() - parameters.validation.holdoutSize;
+        trainShard = SharedPtr<DatasetShard<FPType> >(new DatasetShard<FPType>(reader, 0, numOfTrainObjects));
+        validator = SharedPtr<AsyncValidator<FPType> >(new AsyncValidator<FPType>(
+            readProbe(reader, parameters.validation.holdoutSize, numOfTrainObjects), parameters.validation, parameters.verbose));
+    }
+    DatasetChunkReader<FPType> &trainSet = trainShard ? *trainShard : reader;
+
+    SharedPtr<ShuffledDataset<FPType> > shuffledReader;
+    if (parameters.shuffle)
+    {
+        shuffledReader = SharedPtr<ShuffledDataset<FPType> >(new ShuffledDataset<FPType>(trainSet));
+    }
+    SharedPtr<AugmentedDataset<FPType> > augmentedReader;
+    if (parameters.augmentation.isEnabled())
+    {
+        augmentedReader = SharedPtr<AugmentedDataset<FPType> >(new AugmentedDataset<FPType>(
+            parameters.shuffle ? *shuffledReader : trainSet, parameters.augmentation, parameters.seed));
+    }
+    DatasetChunkReader<FPType> &source = augmentedReader ? *augmentedReader :
+                                         parameters.shuffle ? *shuffledReader : trainSet;
+
+    const size_t batchSize = parameters.batchSize;
+    const size_t chunkSize = batchSize * parameters.batchesPerChunk;
+    ChunkPrefetcher<FPType> prefetcher(source, chunkSize, parameters.prefetchBuffers);
+
+    SharedPtr<TensorChunk<FPType> > probe = readProbe(trainSet, parameters.probeSize);
+
+    bool initialized = false;
+    bool stoppedEarly = false;
+    double totalTime = 0;
+
+    SharedPtr<CheckpointWriter<FPType> > checkpointWriter;
+    if (!parameters.checkpointDirectory.empty() && parameters.checkpointInterval > 0)
+    {
+        checkpointWriter = SharedPtr<CheckpointWriter<FPType> >(new CheckpointWriter<FPType>(parameters.checkpointDirectory));
+    }
+
+    TrainingCursor cursor = { 0, 0, 0, 0, parameters.learningRate, parameters.seed };
+    std::vector<FPType> resumeWeights;
+    std::string resumePath;
+    if (parameters.resume && !parameters.checkpointDirectory.empty() &&
+        CheckpointWriter<FPType>::readLatest(parameters.checkpointDirectory, cursor, resumeWeights, &resumePath))
+    {
+        if (cursor.seed != parameters.seed && parameters.shuffle)
+        {
+            throw std::runtime_error("Checkpoint " + resumePath + " was written by a run with another shuffle seed");
+        }
+        if (parameters.learningRateGiven)
+        {
+            cursor.learningRate = parameters.learningRate;
+        }
+        TrainingParameters resumedParameters = parameters;
+        resumedParameters.learningRate = cursor.learningRate;
+        configureTraining(net, resumedParameters);
+
+        /* The network is initialized as it would be on the first chunk, so that the weights can be
+           restored even if the checkpoint is past the last epoch */
+        Collection<size_t> objectDims = trainSet.getObjectDimensions();
+        Collection<size_t> dataDims;
+        dataDims.push_back(chunkSize);
+        for (size_t i = 0; i < objectDims.size(); i++)
+        {
+            dataDims.push_back(objectDims[i]);
+        }
+        {
+            ScopedPhase phase("initialize");
+            net.initialize(dataDims, *topology);
+        }
+        CheckpointWriter<FPType>::restore(net.getResult()->get(training::model), resumeWeights);
+        initialized = true;
+
+        if (parameters.verbose)
+        {
+            printf("Resumed from %s: epoch %lu, object %lu, %lu minibatches trained, learning rate %g\n", resumePath.c_str(),
+                   (unsigned long)cursor.epoch, (unsigned long)cursor.position, (unsigned long)cursor.numOfMinibatches,
+                   cursor.learningRate);
+        }
+    }
+
+    for (size_t epoch = cursor.epoch; epoch < parameters.numberOfEpochs; epoch++)
+    {
+        std::chrono::steady_clock::time_point epochStart = std::chrono::steady_clock::now();
+
+        if (parameters.shuffle)
+        {
+            shuffledReader->shuffle(parameters.seed + epoch);
+        }
+        if (augmentedReader)
+        {
+            augmentedReader->setEpoch(epoch);
+        }
+        /* A resumed epoch continues after the objects its checkpoint had trained on */
+        source.seek(epoch == cursor.epoch ? cursor.position : 0);
+        cursor.epoch = epoch;
+        cursor.position = source.getPosition();
+        if (cursor.position == 0)
+        {
+            cursor.chunk = 0;
+        }
+        prefetcher.start();
+
+        TensorChunk<FPType> *chunk;
+        size_t chunkIndex = cursor.chunk;
+        while ((chunk = prefetcher.next()) != NULL)
+        {
+            /* The last chunk is trimmed to whole minibatches */
+            size_t numOfObjects = chunk->numOfObjects - chunk->numOfObjects % batchSize;
+            cursor.position += chunk->numOfObjects;
+            if (numOfObjects > 0)
+            {
+                if (!initialized)
+                {
+                    ScopedPhase phase("initialize");
+                    net.initialize(chunk->data->getDimensions(), *topology);
+                    initialized = true;
+                }
+
+                net.input.set(training::data, chunk->getData(numOfObjects));
+                net.input.set(training::groundTruth, chunk->getGroundTruth(numOfObjects));
+                {
+                    ScopedPhase phase("compute");
+                    net.compute();
+                }
+
+                if (listener)
+                {
+                    listener->chunkTrained(net.getResult()->get(training::model), epoch, chunkIndex);
+                }
+                chunkIndex++;
+                cursor.chunk = chunkIndex;
+                cursor.numOfMinibatches += numOfObjects / batchSize;
+
+                if (checkpointWriter && chunkIndex % parameters.checkpointInterval == 0)
+                {
+                    ScopedPhase phase("checkpoint");
+                    checkpointWriter->snapshot(net.getResult()->get(training::model), cursor);
+                }
+                if (validator && parameters.validation.interval > 0 && chunkIndex % parameters.validation.interval == 0)
+                {
+                    ScopedPhase phase("validation snapshot");
+                    validator->snapshot(net.getResult()->get(training::model), epoch, chunkIndex, cursor.numOfMinibatches);
+                }
+            }
+            prefetcher.recycle(chunk);
+
+            if (validator && validator->shouldStop())
+            {
+                stoppedEarly = true;
+                break;
+            }
+        }
+
+        /* The rest of a stopped epoch is not trained on, its statistics would not be comparable */
+        if (stoppedEarly)
+        {
+            prefetcher.stop();
+            break;
+        }
+
+        if (listener && initialized)
+        {
+            listener->epochTrained(net.getResult()->get(training::model), epoch);
+        }
+        if (validator && initialized)
+        {
+            ScopedPhase phase("validation snapshot");
+            validator->snapshot(net.getResult()->get(training::model), epoch, chunkIndex, cursor.numOfMinibatches);
+        }
+
+        EpochStatistics epochStatistics;
+        epochStatistics.epoch = epoch;
+        epochStatistics.time = std::chrono::duration<double>(std::chrono::steady_clock::now() - epochStart).count();
+        epochStatistics.stallTime = prefetcher.getStallTime();
+        epochStatistics.loss = epochStatistics.accuracy = 0;
+        totalTime += epochStatistics.time;
+
+        if (probe && initialized)
+        {
+            ScopedPhase phase("validation");
+            prediction::ResultPtr result = predict<FPType>(
+                net.getResult()->get(training::model)->template getPredictionModel<FPType>(), probe->data);
+            epochStatistics.loss = computeLoss<FPType>(result, probe->groundTruth);
+            epochStatistics.accuracy = computeAccuracy<FPType>(result, probe->groundTruth);
+        }
+
+        if (parameters.verbose)
+        {
+            printf("Epoch %lu: %.3f s (total %.3f s), waiting for data %.3f s (%.1f%%), loss %.4f, accuracy %.4f\n",
+                   (unsigned long)epoch, epochStatistics.time, totalTime, epochStatistics.stallTime,
+                   epochStatistics.time > 0 ? 100.0 * epochStatistics.stallTime / epochStatistics.time : 0.0,
+                   epochStatistics.loss, epochStatistics.accuracy);
+        }
+
+        if (statistics)
+        {
+            statistics->push_back(epochStatistics);
+        }
+
+        if (checkpointWriter && initialized)
+        {
+            ScopedPhase phase("checkpoint");
+            TrainingCursor nextEpoch = cursor;
+            nextEpoch.epoch = epoch + 1;
+            nextEpoch.position = nextEpoch.chunk = 0;
+            checkpointWriter->snapshot(net.getResult()->get(training::model), nextEpoch);
+        }
+
+        if (listener && initialized && !listener->epochFinished(net.getResult()->get(training::model), epochStatistics))
+        {
+            break;
+        }
+        if (validator && validator->shouldStop())
+        {
+            stoppedEarly = epoch + 1 < parameters.numberOfEpochs;
+            break;
+        }
+    }
+
+    if (validator)
+    {
+        validator->flush();
+        if (parameters.verbose)
+        {
+            std::vector<ValidationRecord> history = validator->getHistory();
+            printf("Validation: %lu runs on %lu held-out objects in %.3f s in the background, %lu replaced by newer ones before running\n",
+                   (unsigned long)history.size(), (unsigned long)parameters.validation.holdoutSize,
+                   validator->getValidationTime(), (unsigned long)validator->getNumberOfSkipped());
+            if (stoppedEarly)
+            {
+                printf("Training stopped early after %lu minibatches: %s\n", (unsigned long)cursor.numOfMinibatches,
+                       validator->getStopReason().c_str());
+            }
+        }
+    }
+
+    if (checkpointWriter)
+    {
+        checkpointWriter->flush();
+        if (parameters.verbose)
+        {
+            printf("Checkpoints: %lu written to %s in %.3f s in the background, %lu replaced by newer ones before writing\n",
+                   (unsigned long)checkpointWriter->getNumberOfWrites(), parameters.checkpointDirectory.c_str(),
+                   checkpointWriter->getWriteTime(), (unsigned long)checkpointWriter->getNumberOfSkipped());
+        }
+    }
+
+    /* No model exists if every chunk was shorter than a minibatch */
+    if (!initialized)
+    {
+        char message[160];
+        snprintf(message, sizeof(message), "No minibatch was trained: %lu train objects in chunks of %lu, minibatches of %lu",
+                 (unsigned long)trainSet.getNumberOfObjects(), (unsigned long)chunkSize, (unsigned long)batchSize);
+        throw std::runtime_error(message);
+    }
+    profileTraining<FPType>(net.getResult()->get(training::model), parameters);
+    return net.getResult()->get(training::model)->template getPredictionModel<FPType>();
+}
+
+/*LeNet training*/
+template<typename FPType>
+prediction::ModelPtr trainModel(const TensorPtr &trainingData, const TensorPtr &trainingGroundTruth,
+                                const TrainingParameters &parameters)
+{
+    if (parameters.numberOfEpochs > 1 || parameters.shuffle || !parameters.checkpointDirectory.empty() ||
+        parameters.augmentation.isEnabled() || parameters.validation.isEnabled())
+    {
+        TensorDataset<FPType> dataset(trainingData, trainingGroundTruth);
+        return trainModelStreaming<FPType>(dataset, parameters);
+    }
+
+    training::TopologyPtr topology = configureTopology<FPType>(parameters);
+
+    training::Batch<FPType> net;
+    configureTraining(net, parameters);
+
+    {
+        ScopedPhase phase("initialize");
+        net.initialize(trainingData->getDimensions(), *topology);
+    }
+
+    net.input.set(training::data, trainingData);
+    net.input.set(training::groundTruth, trainingGroundTruth);
+    {
+        ScopedPhase phase("compute");
+        net.compute();
+    }
+
+    profileTraining<FPType>(net.getResult()->get(training::model), parameters);
+    return net.getResult()->get(training::model)->template getPredictionModel<FPType>();
+}
+
+/*LeNet testing*/
+template<typename FPType>
+prediction::ResultPtr predict(const prediction::ModelPtr &predictionModel, const TensorPtr &testingData)
+{
+    prediction::Batch<FPType> net;
+
+    net.input.set(prediction::model, predictionModel);
+    net.input.set(prediction::data, testingData);
+
+    ScopedPhase phase("prediction");
+    net.compute();
+
+    return net.getResult();
+}
+
+/*Prediction on consecutive chunks with one prediction::Batch. The result tensor of the first chunk
+  becomes the output buffer of all later chunks, so chunks do not allocate*/
+template<typename FPType>
+class ChunkPredictor
+{
+public:
+
+    ChunkPredictor(const prediction::ModelPtr &predictionModel)
+    {
+        _net.input.set(prediction::model, predictionModel);
+    }
+
+    prediction::ResultPtr operator()(const TensorPtr &data)
+    {
+        const size_t n = data->getDimensionSize(0);
+        if (_buffer && n <= _buffer->getDimensionSize(0))
+        {
+            Collection<size_t> dims = _buffer->getDimensions();
+            dims[0] = n;
+            prediction::ResultPtr result(new prediction::Result());
+            result->set(prediction::prediction, TensorPtr(new HomogenTensor<FPType>(dims, _buffer->getArray())));
+            _net.setResult(result);
+        }
+
+        _net.input.set(prediction::data, data);
+        {
+            ScopedPhase phase("prediction");
+            _net.compute();
+        }
+
+        prediction::ResultPtr result = _net.getResult();
+        if (!_buffer)
+        {
+            _buffer = dynamicPointerCast<HomogenTensor<FPType>, Tensor>(result->get(prediction::prediction));
+        }
+        return result;
+    }
+
+private:
+    prediction::Batch<FPType> _net;
+    SharedPtr<HomogenTensor<FPType> > _buffer;
+};
+
+/*Evaluation of predictions made chunk by chunk. Only the counts of the evaluation are kept,
+  so memory depends on the chunk size and not on the number of objects.
+  predictor maps a data tensor to a prediction result, e.g. a ChunkPredictor*/
+template<typename FPType, typename Predictor>
+Evaluation evaluateChunks(DatasetChunkReader<FPType> &reader, size_t chunkSize, size_t prefetchBuffers, size_t maxK,
+                          Predictor &predictor)
+{
+    ChunkPrefetcher<FPType> prefetcher(reader, std::max<size_t>(chunkSize, 1), prefetchBuffers);
+    reader.rewind();
+    prefetcher.start();
+
+    Evaluation evaluation;
+    TensorChunk<FPType> *chunk;
+    while ((chunk = prefetcher.next()) != NULL)
+    {
+        const size_t n = chunk->numOfObjects;
+        Evaluation chunkEvaluation = evaluate<FPType>(predictor(chunk->getData(n)), chunk->getGroundTruth(n), maxK);
+        if (evaluation.getNumberOfObjects() == 0)
+        {
+            evaluation = chunkEvaluation;
+        }
+        else
+        {
+            evaluation.merge(chunkEvaluation);
+        }
+        prefetcher.recycle(chunk);
+    }
+    return evaluation;
+}
+
+/*LeNet testing on a dataset read chunk by chunk*/
+template<typename FPType>
+Evaluation predictStreaming(const prediction::ModelPtr &predictionModel, DatasetChunkReader<FPType> &reader,
+                            size_t chunkSize, size_t prefetchBuffers = 2, size_t maxK = 5)
+{
+    ChunkPredictor<FPType> predictor(predictionModel);
+    return evaluateChunks<FPType>(reader, chunkSize, prefetchBuffers, maxK, predictor);
+}
+
+/*Share of objects whose most probable class matches the ground truth*/
+template<typename FPType>
+double computeAccuracy(const prediction::ResultPtr &predictionResult, const TensorPtr &testingGroundTruth)
+{
+    return evaluate<FPType>(predictionResult, testingGroundTruth, 1).getAccuracy();
+}
+
+/*Mean cross-entropy of the predicted class probabilities*/
+template<typename FPType>
+double computeLoss(const prediction::ResultPtr &predictionResult, const TensorPtr &testingGroundTruth)
+{
+    return evaluate<FPType>(predictionResult, testingGroundTruth, 1).getLoss();
+}
+
+#endif
@@ -0,0 +1,505 @@
+/* file: lenet_quantized.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Post-training int8 quantization of the LeNet topology with int32 accumulation
+!******************************************************************************/
+
+#ifndef _LENET_QUANTIZED_H
+#define _LENET_QUANTIZED_H
+
+#include "lenet_native.h"
+#include <cstdint>
+#include <cstring>
+
+/* Symmetric int8 LeNet built from a trained model.
+   Weights get one scale per output channel from their largest magnitude. The input of every layer
+   gets one scale measured on calibration objects that have already passed the quantized preceding
+   layers, so that the scales absorb the error of those layers.
+   Products of int8 weights and activations are summed in int32 with SSE2 multiply-adds of
+   adjacent pairs, then scaled back to float for the bias, pooling, ReLU and softmax.
+   Activations are held as int16 in the int8 range, the form the multiply-add consumes */
+template<typename FPType, size_t ImageSize = 28>
+class QuantizedLeNet
+{
+public:
+
+    typedef NativeLeNet<FPType, ImageSize> Native;
+
+    static const size_t C1 = 2;                         /* conv1 input channels, the image and a zero channel */
+    static const size_t K1 = Native::K1;
+    static const size_t R1 = Native::R1;
+    static const size_t P1 = Native::P1;
+    static const size_t K2 = Native::K2;
+    static const size_t R2 = Native::R2;
+    static const size_t P2 = Native::P2;
+    static const size_t N3 = Native::N3;
+    static const size_t F3 = Native::F3;
+    static const size_t F4 = Native::F4;
+    static const size_t BLOCK = Native::BLOCK;
+
+    /* calibrationData: objects of the train set, n x 1 x ImageSize x ImageSize */
+    QuantizedLeNet(const prediction::ModelPtr &model, const TensorPtr &calibrationData)
+    {
+        SharedPtr<ForwardLayers> forwardLayers = model->getLayers();
+        if (forwardLayers->size() < 8)
+        {
+            throw std::runtime_error("Model does not have the LeNet topology");
+        }
+
+        std::vector<FPType> w;
+        std::vector<int8_t> q;
+
+        /* Convolutions: [k][c][ky][kx] to [ky][kx][c / 2][k][c % 2] */
+        Native::readLayer(forwardLayers, 0, K1, K1 * R1 * R1, w, _b1);
+        quantizeWeights(w, K1, q, _ws1);
+        _w1.assign(R1 * R1 * C1 * K1, 0);
+        for (size_t k = 0; k < K1; k++)
+        {
+            for (size_t r = 0; r < R1 * R1; r++)
+            {
+                _w1[(r * K1 + k) * 2] = q[k * R1 * R1 + r];
+            }
+        }
+
+        Native::readLayer(forwardLayers, 2, K2, K2 * K1 * R2 * R2, w, _b2);
+        quantizeWeights(w, K2, q, _ws2);
+        _w2.resize(q.size());
+        for (size_t k = 0; k < K2; k++)
+        {
+            for (size_t c = 0; c < K1; c++)
+            {
+                for (size_t r = 0; r < R2 * R2; r++)
+                {
+                    _w2[((r * (K1 / 2) + c / 2) * K2 + k) * 2 + c % 2] = q[(k * K1 + c) * R2 * R2 + r];
+                }
+            }
+        }
+
+        /* FC256: [j][c][p] to [j / GROUP][i / 2][j % GROUP][i % 2] with the HWC input index i = p * K2 + c */
+        Native::readLayer(forwardLayers, 4, F3, F3 * N3, w, _b3);
+        quantizeWeights(w, F3, q, _ws3);
+        _w3.resize(q.size());
+        for (size_t j = 0; j < F3; j++)
+        {
+            for (size_t c = 0; c < K2; c++)
+            {
+                for (size_t p = 0; p < P2 * P2; p++)
+                {
+                    const size_t i = p * K2 + c;
+                    _w3[(((j / GROUP) * (N3 / 2) + i / 2) * GROUP + j % GROUP) * 2 + i % 2] = q[j * N3 + c * P2 * P2 + p];
+                }
+            }
+        }
+
+        /* FC10 keeps the [j][i] layout, it is computed per object */
+        Native::readLayer(forwardLayers, 6, F4, F4 * F3, w, _b4);
+        quantizeWeights(w, F4, _w4, _ws4);
+
+        SubtensorDescriptor<FPType> block;
+        const size_t n = calibrationData->getDimensionSize(0);
+        calibrationData->getSubtensor(0, 0, 0, n, readOnly, block);
+        calibrate(block.getPtr(), n);
+        calibrationData->releaseSubtensor(block);
+    }
+
+    /* images: n x 1 x ImageSize x ImageSize, probabilities: n x 10 */
+    void forward(const FPType *images, size_t n, FPType *probabilities) const
+    {
+        const size_t nBlocks = (n + BLOCK - 1) / BLOCK;
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, nBlocks), [&](const tbb::blocked_range<size_t> &range)
+        {
+            std::vector<int16_t> image(ImageSize * ImageSize * C1);
+            std::vector<float> pooled1(P1 * P1 * K1);
+            std::vector<int16_t> quantized1(P1 * P1 * K1);
+            std::vector<float> pooled2(N3);
+            std::vector<int16_t> quantized2(BLOCK * N3);
+            std::vector<float> hidden(BLOCK * F3);
+
+            for (size_t block = range.begin(); block < range.end(); block++)
+            {
+                const size_t first = block * BLOCK;
+                const size_t count = std::min(BLOCK, n - first);
+
+                for (size_t i = 0; i < count; i++)
+                {
+                    quantizeImage(images + (first + i) * ImageSize * ImageSize, &image[0]);
+                    convolutionPool<ImageSize, C1, K1, R1>(&image[0], &_w1[0], &_scale1[0], &_b1f[0], &pooled1[0]);
+                    quantize(&pooled1[0], pooled1.size(), _inputScale[1], &quantized1[0]);
+                    convolutionPool<P1, K1, K2, R2>(&quantized1[0], &_w2[0], &_scale2[0], &_b2f[0], &pooled2[0]);
+                    quantize(&pooled2[0], N3, _inputScale[2], &quantized2[i * N3]);
+                }
+
+                const size_t paddedCount = (count + 3) / 4 * 4;
+                std::fill(quantized2.begin() + count * N3, quantized2.begin() + paddedCount * N3, (int16_t)0);
+
+                fullyConnectedRelu3(&quantized2[0], paddedCount, &hidden[0]);
+                fullyConnectedSoftmax4(&hidden[0], count, probabilities + first * F4);
+            }
+        });
+    }
+
+    /* Same input and output as prediction::Batch on the LeNet prediction model */
+    TensorPtr predict(const TensorPtr &data) const
+    {
+        const Collection<size_t> &dims = data->getDimensions();
+        if (dims.size() != 4 || dims[1] != 1 || dims[2] != ImageSize || dims[3] != ImageSize)
+        {
+            throw std::runtime_error("Quantized LeNet got objects of unsupported shape");
+        }
+
+        const size_t n = dims[0];
+        Collection<size_t> resultDims;
+        resultDims.push_back(n);
+        resultDims.push_back(F4);
+        SharedPtr<HomogenTensor<FPType> > result = makePooledTensor<FPType>(resultDims);
+
+        SubtensorDescriptor<FPType> block;
+        data->getSubtensor(0, 0, 0, n, readOnly, block);
+        forward(block.getPtr(), n, result->getArray());
+        data->releaseSubtensor(block);
+
+        return result;
+    }
+
+    /* Bytes of the int8 weights, the model holds the same number of FPType values */
+    inline size_t getWeightsSize() const { return _w1.size() / 2 + _w2.size() + _w3.size() + _w4.size(); }
+
+    /* Scales of the inputs of conv1, conv2, FC256 and FC10 */
+    inline const float *getInputScales() const { return _inputScale; }
+
+private:
+
+    /* Output channels accumulated together, two vectors of int32 */
+    static const size_t GROUP = 8;
+
+    static inline int8_t saturate(float value)
+    {
+        return (int8_t)std::max(-127.0f, std::min(127.0f, std::floor(value + 0.5f)));
+    }
+
+    template<typename T>
+    static float maxMagnitude(const T *values, size_t n)
+    {
+        float maxValue = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            maxValue = std::max(maxValue, (float)std::fabs(values[i]));
+        }
+        return maxValue > 0 ? maxValue / 127.0f : 1.0f;
+    }
+
+    /* Per output channel: scale = max |w| / 127, q = round(w / scale) */
+    static void quantizeWeights(const std::vector<FPType> &weights, size_t nOutputs,
+                                std::vector<int8_t> &quantized, std::vector<float> &scales)
+    {
+        const size_t size = weights.size() / nOutputs;
+        quantized.resize(weights.size());
+        scales.resize(nOutputs);
+        for (size_t k = 0; k < nOutputs; k++)
+        {
+            scales[k] = maxMagnitude(&weights[k * size], size);
+            for (size_t i = 0; i < size; i++)
+            {
+                quantized[k * size + i] = saturate((float)weights[k * size + i] / scales[k]);
+            }
+        }
+    }
+
+    /* Scales that turn the int32 sums of a layer back into float: input scale times weight scale */
+    void setInputScale(size_t layer, float scale)
+    {
+        _inputScale[layer] = scale;
+
+        const std::vector<float> *weightScales[] = { &_ws1, &_ws2, &_ws3, &_ws4 };
+        std::vector<float> *scales[] = { &_scale1, &_scale2, &_scale3, &_scale4 };
+        scales[layer]->resize(weightScales[layer]->size());
+        for (size_t k = 0; k < scales[layer]->size(); k++)
+        {
+            (*scales[layer])[k] = scale * (*weightScales[layer])[k];
+        }
+    }
+
+    /* Measures the range of the input of every layer in turn, running the calibration objects
+       through the layers that are already quantized */
+    void calibrate(const FPType *images, size_t n)
+    {
+        if (n == 0)
+        {
+            throw std::runtime_error("Quantization needs calibration objects");
+        }
+
+        _b1f.assign(_b1.begin(), _b1.end());
+        _b2f.assign(_b2.begin(), _b2.end());
+        _b3f.assign(_b3.begin(), _b3.end());
+        _b4f.assign(_b4.begin(), _b4.end());
+
+        setInputScale(0, maxMagnitude(images, n * ImageSize * ImageSize));
+
+        std::vector<float> pooled1(n * P1 * P1 * K1);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, n), [&](const tbb::blocked_range<size_t> &range)
+        {
+            std::vector<int16_t> image(ImageSize * ImageSize * C1);
+            for (size_t i = range.begin(); i < range.end(); i++)
+            {
+                quantizeImage(images + i * ImageSize * ImageSize, &image[0]);
+                convolutionPool<ImageSize, C1, K1, R1>(&image[0], &_w1[0], &_scale1[0], &_b1f[0], &pooled1[i * P1 * P1 * K1]);
+            }
+        });
+        setInputScale(1, maxMagnitude(&pooled1[0], pooled1.size()));
+
+        std::vector<float> pooled2(n * N3);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, n), [&](const tbb::blocked_range<size_t> &range)
+        {
+            std::vector<int16_t> quantized1(P1 * P1 * K1);
+            for (size_t i = range.begin(); i < range.end(); i++)
+            {
+                quantize(&pooled1[i * P1 * P1 * K1], P1 * P1 * K1, _inputScale[1], &quantized1[0]);
+                convolutionPool<P1, K1, K2, R2>(&quantized1[0], &_w2[0], &_scale2[0], &_b2f[0], &pooled2[i * N3]);
+            }
+        });
+        setInputScale(2, maxMagnitude(&pooled2[0], pooled2.size()));
+
+        const size_t paddedCount = (n + 3) / 4 * 4;
+        std::vector<int16_t> quantized2(paddedCount * N3, 0);
+        quantize(&pooled2[0], n * N3, _inputScale[2], &quantized2[0]);
+        std::vector<float> hidden(paddedCount * F3);
+        fullyConnectedRelu3(&quantized2[0], paddedCount, &hidden[0]);
+        setInputScale(3, maxMagnitude(&hidden[0], n * F3));
+    }
+
+    /* One channel of pixels becomes the pair (pixel, 0) of the padded conv1 input */
+    void quantizeImage(const FPType *image, int16_t *quantized) const
+    {
+        const float inverse = 1.0f / _inputScale[0];
+        for (size_t i = 0; i < ImageSize * ImageSize; i++)
+        {
+            quantized[2 * i] = saturate((float)image[i] * inverse);
+            quantized[2 * i + 1] = 0;
+        }
+    }
+
+    static void quantize(const float *values, size_t n, float scale, int16_t *quantized)
+    {
+        const float inverse = 1.0f / scale;
+        const __m128 inverseVector = _mm_set1_ps(inverse);
+        const __m128i minValue = _mm_set1_epi16(-127);
+        const __m128i maxValue = _mm_set1_epi16(127);
+
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(values + i), inverseVector));
+            __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(values + i + 4), inverseVector));
+            __m128i packed = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(lo, hi), minValue), maxValue);
+            _mm_storeu_si128((__m128i *)(quantized + i), packed);
+        }
+        for (; i < n; i++)
+        {
+            quantized[i] = saturate(values[i] * inverse);
+        }
+    }
+
+    /* Two adjacent int16 activations in every int32 lane */
+    static inline __m128i loadPair(const int16_t *p)
+    {
+        int32_t pair;
+        memcpy(&pair, p, sizeof(pair));
+        return _mm_set1_epi32(pair);
+    }
+
+    /* 16 int8 weights of GROUP outputs and 2 inputs, sign-extended to int16 */
+    static inline void loadWeights(const int8_t *p, __m128i &w0, __m128i &w1)
+    {
+        const __m128i w = _mm_loadu_si128((const __m128i *)p);
+        w0 = _mm_srai_epi16(_mm_unpacklo_epi8(w, w), 8);
+        w1 = _mm_srai_epi16(_mm_unpackhi_epi8(w, w), 8);
+    }
+
+    static inline __m128i multiplyAdd(__m128i acc, __m128i x, __m128i w)
+    {
+        return _mm_add_epi32(acc, _mm_madd_epi16(x, w));
+    }
+
+    /* Same loop structure as NativeLeNet::convolutionPool with C even.
+       input: In x In x C, weights: R x R x C / 2 x K x 2, pooled: Out x Out x K in float */
+    template<size_t In, size_t C, size_t K, size_t R>
+    static void convolutionPool(const int16_t *input, const int8_t *weights, const float *scales, const float *biases,
+                                float *pooled)
+    {
+        const size_t Out = (In - R + 1) / 2;
+
+        for (size_t py = 0; py < Out; py++)
+        {
+            for (size_t px = 0; px < Out; px++)
+            {
+                for (size_t k = 0; k < K; k += GROUP)
+                {
+                    __m128i a00 = _mm_setzero_si128(), a01 = _mm_setzero_si128();
+                    __m128i a10 = _mm_setzero_si128(), a11 = _mm_setzero_si128();
+                    __m128i a20 = _mm_setzero_si128(), a21 = _mm_setzero_si128();
+                    __m128i a30 = _mm_setzero_si128(), a31 = _mm_setzero_si128();
+
+                    for (size_t ky = 0; ky < R; ky++)
+                    {
+                        for (size_t kx = 0; kx < R; kx++)
+                        {
+                            const int8_t *w = weights + (ky * R + kx) * C * K + 2 * k;
+                            const int16_t *s0 = input + ((2 * py + ky) * In + 2 * px + kx) * C;
+                            const int16_t *s1 = s0 + C;
+                            const int16_t *s2 = s0 + In * C;
+                            const int16_t *s3 = s2 + C;
+                            for (size_t c = 0; c < C; c += 2)
+                            {
+                                __m128i w0, w1, x;
+                                loadWeights(w + c * K, w0, w1);
+                                x = loadPair(s0 + c); a00 = multiplyAdd(a00, x, w0); a01 = multiplyAdd(a01, x, w1);
+                                x = loadPair(s1 + c); a10 = multiplyAdd(a10, x, w0); a11 = multiplyAdd(a11, x, w1);
+                                x = loadPair(s2 + c); a20 = multiplyAdd(a20, x, w0); a21 = multiplyAdd(a21, x, w1);
+                                x = loadPair(s3 + c); a30 = multiplyAdd(a30, x, w0); a31 = multiplyAdd(a31, x, w1);
+                            }
+                        }
+                    }
+
+                    /* Scales are positive, so the maximum is taken before scaling */
+                    const __m128 m0 = _mm_max_ps(_mm_max_ps(_mm_cvtepi32_ps(a00), _mm_cvtepi32_ps(a10)),
+                                                 _mm_max_ps(_mm_cvtepi32_ps(a20), _mm_cvtepi32_ps(a30)));
+                    const __m128 m1 = _mm_max_ps(_mm_max_ps(_mm_cvtepi32_ps(a01), _mm_cvtepi32_ps(a11)),
+                                                 _mm_max_ps(_mm_cvtepi32_ps(a21), _mm_cvtepi32_ps(a31)));
+
+                    float *dst = pooled + (py * Out + px) * K + k;
+                    _mm_storeu_ps(dst,     _mm_add_ps(_mm_mul_ps(m0, _mm_loadu_ps(scales + k)), _mm_loadu_ps(biases + k)));
+                    _mm_storeu_ps(dst + 4, _mm_add_ps(_mm_mul_ps(m1, _mm_loadu_ps(scales + k + 4)), _mm_loadu_ps(biases + k + 4)));
+                }
+            }
+        }
+    }
+
+    /* count is a multiple of 4. Every group of weights is streamed once per 4 objects */
+    void fullyConnectedRelu3(const int16_t *input, size_t count, float *hidden) const
+    {
+        const __m128 zero = _mm_setzero_ps();
+
+        for (size_t b = 0; b < count; b += 4)
+        {
+            const int16_t *x0 = input + b * N3;
+            const int16_t *x1 = x0 + N3;
+            const int16_t *x2 = x1 + N3;
+            const int16_t *x3 = x2 + N3;
+
+            for (size_t j = 0; j < F3; j += GROUP)
+            {
+                __m128i a00 = _mm_setzero_si128(), a01 = _mm_setzero_si128();
+                __m128i a10 = _mm_setzero_si128(), a11 = _mm_setzero_si128();
+                __m128i a20 = _mm_setzero_si128(), a21 = _mm_setzero_si128();
+                __m128i a30 = _mm_setzero_si128(), a31 = _mm_setzero_si128();
+
+                const int8_t *w = &_w3[(j / GROUP) * N3 * GROUP];
+                for (size_t i = 0; i < N3; i += 2)
+                {
+                    __m128i w0, w1, x;
+                    loadWeights(w + i * GROUP, w0, w1);
+                    x = loadPair(x0 + i); a00 = multiplyAdd(a00, x, w0); a01 = multiplyAdd(a01, x, w1);
+                    x = loadPair(x1 + i); a10 = multiplyAdd(a10, x, w0); a11 = multiplyAdd(a11, x, w1);
+                    x = loadPair(x2 + i); a20 = multiplyAdd(a20, x, w0); a21 = multiplyAdd(a21, x, w1);
+                    x = loadPair(x3 + i); a30 = multiplyAdd(a30, x, w0); a31 = multiplyAdd(a31, x, w1);
+                }
+
+                const __m128 scale0 = _mm_loadu_ps(&_scale3[j]), scale1 = _mm_loadu_ps(&_scale3[j + 4]);
+                const __m128 bias0 = _mm_loadu_ps(&_b3f[j]), bias1 = _mm_loadu_ps(&_b3f[j + 4]);
+                const __m128i acc[4][2] = { { a00, a01 }, { a10, a11 }, { a20, a21 }, { a30, a31 } };
+                for (size_t o = 0; o < 4; o++)
+                {
+                    float *h = hidden + (b + o) * F3 + j;
+                    _mm_storeu_ps(h,     _mm_max_ps(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(acc[o][0]), scale0), bias0), zero));
+                    _mm_storeu_ps(h + 4, _mm_max_ps(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(acc[o][1]), scale1), bias1), zero));
+                }
+            }
+        }
+    }
+
+    void fullyConnectedSoftmax4(const float *hidden, size_t count, FPType *probabilities) const
+    {
+        int16_t quantized[F3];
+        for (size_t b = 0; b < count; b++)
+        {
+            quantize(hidden + b * F3, F3, _inputScale[3], quantized);
+
+            FPType *out = probabilities + b * F4;
+            for (size_t j = 0; j < F4; j++)
+            {
+                int32_t sum = 0;
+                for (size_t i = 0; i < F3; i++)
+                {
+                    sum += (int32_t)quantized[i] * _w4[j * F3 + i];
+                }
+                out[j] = (FPType)(sum * _scale4[j] + _b4f[j]);
+            }
+
+            const FPType maxValue = *std::max_element(out, out + F4);
+            FPType sum = 0;
+            for (size_t j = 0; j < F4; j++)
+            {
+                out[j] = std::exp(out[j] - maxValue);
+                sum += out[j];
+            }
+            for (size_t j = 0; j < F4; j++)
+            {
+                out[j] /= sum;
+            }
+        }
+    }
+
+    std::vector<int8_t> _w1, _w2, _w3, _w4;
+    /* Weight scales per output channel */
+    std::vector<float> _ws1, _ws2, _ws3, _ws4;
+    /* Weight scales times the input scale of the layer */
+    std::vector<float> _scale1, _scale2, _scale3, _scale4;
+    std::vector<FPType> _b1, _b2, _b3, _b4;
+    std::vector<float> _b1f, _b2f, _b3f, _b4f;
+    float _inputScale[4];
+};
+
+template<typename FPType, size_t ImageSize> const size_t QuantizedLeNet<FPType, ImageSize>::C1;
+template<typename FPType, size_t ImageSize> const size_t QuantizedLeNet<FPType, ImageSize>::K1;
+template<typename FPType, size_t ImageSize> const size_t QuantizedLeNet<FPType, ImageSize>::R1;
+template<typename FPType, size_t ImageSize> const size_t QuantizedLeNet<FPType, ImageSize>::P1;
+template<typename FPType, size_t ImageSize> const size_t QuantizedLeNet<FPType, ImageSize>::K2;
+template<typename FPType, size_t ImageSize> const size_t QuantizedLeNet<FPType, ImageSize>::R2;
+template<typename FPType, size_t ImageSize> const size_t QuantizedLeNet<FPType, ImageSize>::P2;
+template<typename FPType, size_t ImageSize> const size_t QuantizedLeNet<FPType, ImageSize>::N3;
+template<typename FPType, size_t ImageSize> const size_t QuantizedLeNet<FPType, ImageSize>::F3;
+template<typename FPType, size_t ImageSize> const size_t QuantizedLeNet<FPType, ImageSize>::F4;
+template<typename FPType, size_t ImageSize> const size_t QuantizedLeNet<FPType, ImageSize>::BLOCK;
+template<typename FPType, size_t ImageSize> const size_t QuantizedLeNet<FPType, ImageSize>::GROUP;
+
+/* Prediction result of the quantized network, interchangeable with the one of prediction::Batch */
+template<typename FPType, size_t ImageSize>
+prediction::ResultPtr predictQuantized(const QuantizedLeNet<FPType, ImageSize> &quantizedNet, const TensorPtr &data)
+{
+    prediction::ResultPtr result(new prediction::Result());
+    result->set(prediction::prediction, quantizedNet.predict(data));
+    return result;
+}
+
+/* Predictor of evaluateChunks on the quantized network */
+template<typename FPType, size_t ImageSize = 28>
+class QuantizedPredictor
+{
+public:
+    QuantizedPredictor(const QuantizedLeNet<FPType, ImageSize> &quantizedNet) : _quantizedNet(quantizedNet) { }
+
+    prediction::ResultPtr operator()(const TensorPtr &data) { return predictQuantized(_quantizedNet, data); }
+
+private:
+    const QuantizedLeNet<FPType, ImageSize> &_quantizedNet;
+};
+
+#endif
@@ -0,0 +1,127 @@
+/* file: mapped_file.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+#ifndef _MAPPED_FILE_H
+#define _MAPPED_FILE_H
+
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Memory mapping of a whole file. The mapping is read-only unless it is opened as
+   copy-on-write, then writes are allowed but never reach the file */
+class MappedFile
+{
+public:
+
+    MappedFile() : _data(NULL), _size(0) { }
+
+    explicit MappedFile(const std::string &path, bool copyOnWrite = false) : _data(NULL), _size(0)
+    {
+        open(path, copyOnWrite);
+    }
+
+    ~MappedFile() { close(); }
+
+    void open(const std::string &path, bool copyOnWrite = false)
+    {
+        close();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Unable to open file " + path);
+        }
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("Unable to get size of file " + path);
+        }
+
+        _size = (size_t)fileStat.st_size;
+        if (_size > 0)
+        {
+            int protection = copyOnWrite ? (PROT_READ | PROT_WRITE) : PROT_READ;
+            void *ptr = mmap(NULL, _size, protection, MAP_PRIVATE, fd, 0);
+            if (ptr == MAP_FAILED)
+            {
+                ::close(fd);
+                _size = 0;
+                throw std::runtime_error("Unable to map file " + path);
+            }
+            _data = (const uint8_t *)ptr;
+        }
+
+        /* The mapping stays valid after the descriptor is closed */
+        ::close(fd);
+    }
+
+    void close()
+    {
+        if (_data)
+        {
+            munmap((void *)_data, _size);
+        }
+        _data = NULL;
+        _size = 0;
+    }
+
+    /* Hints the kernel to read ahead the given byte range in order */
+    void adviseSequential(size_t offset = 0, size_t length = 0)
+    {
+        if (!_data || offset >= _size) { return; }
+
+        size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        size_t alignedOffset = offset - offset % pageSize;
+        if (length == 0 || offset + length > _size)
+        {
+            length = _size - offset;
+        }
+        length += offset - alignedOffset;
+
+        madvise((void *)(_data + alignedOffset), length, MADV_SEQUENTIAL);
+        madvise((void *)(_data + alignedOffset), length, MADV_WILLNEED);
+    }
+
+    /* Drops the pages of an already consumed byte range from memory, they are re-read on next access */
+    void release(size_t offset, size_t length)
+    {
+        if (!_data || offset >= _size) { return; }
+
+        size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        size_t alignedOffset = (offset + pageSize - 1) / pageSize * pageSize;
+        size_t end = std::min(offset + length, _size);
+        end -= end % pageSize;
+        if (end > alignedOffset)
+        {
+            madvise((void *)(_data + alignedOffset), end - alignedOffset, MADV_DONTNEED);
+        }
+    }
+
+    inline const uint8_t *data() const { return _data; }
+    inline size_t size() const { return _size; }
+    inline bool isOpen() const { return _data != NULL; }
+
+private:
+
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+
+    const uint8_t *_data;
+    size_t _size;
+};
+
+#endif
@@ -0,0 +1,275 @@
+/* file: model_file.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Binary file of trained LeNet weights that is mapped back into a prediction model
+!******************************************************************************/
+
+#ifndef _MODEL_FILE_H
+#define _MODEL_FILE_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+#include "daal.h"
+#include "mapped_file.h"
+#include "tensor_cache.h"
+
+using namespace daal;
+using namespace daal::algorithms;
+using namespace daal::algorithms::neural_networks;
+using namespace daal::services;
+using namespace daal::data_management;
+
+/* Layout of a model file: header, table of tensors, then the data of every tensor
+   starting at a multiple of ALIGNMENT bytes from the page-aligned start of the file */
+struct ModelFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t typeSize;
+    /* Shape of the objects the model was trained on and the minibatch size, used to allocate the network */
+    uint64_t batchSize;
+    uint64_t objectDims[3];
+    uint64_t numOfLayers;
+    uint64_t numOfTensors;
+};
+
+struct ModelFileTensor
+{
+    uint64_t layer;
+    /* layers::forward::weights or layers::forward::biases */
+    uint64_t input;
+    uint64_t numOfDims;
+    uint64_t dims[6];
+    uint64_t offset;
+};
+
+/* Reads the header only, e.g. to choose the floating-point type before the model is loaded */
+inline ModelFileHeader readModelFileHeader(const std::string &path)
+{
+    ModelFileHeader header;
+    std::ifstream stream(path.c_str(), std::ifstream::in | std::ifstream::binary);
+    stream.read((char *)&header, sizeof(header));
+    if (!stream.good() || memcmp(header.magic, "LENETMD", 8) != 0)
+    {
+        throw std::runtime_error("File " + path + " is not a LeNet model");
+    }
+    return header;
+}
+
+template<typename FPType>
+class ModelFile
+{
+public:
+
+    static const uint32_t VERSION = 1;
+    static const size_t ALIGNMENT = 64;
+
+    ModelFile(const std::string &path) : _path(path) { }
+
+    /* Writes the weights and biases of every layer through a temporary file */
+    void save(const prediction::ModelPtr &model, const Collection<size_t> &objectDims, size_t batchSize)
+    {
+        SharedPtr<ForwardLayers> forwardLayers = model->getLayers();
+
+        std::vector<ModelFileTensor> entries;
+        std::vector<TensorPtr> tensors;
+        const layers::forward::InputId inputs[] = { layers::forward::weights, layers::forward::biases };
+        for (size_t i = 0; i < forwardLayers->size(); i++)
+        {
+            for (size_t j = 0; j < 2; j++)
+            {
+                TensorPtr tensor = forwardLayers->get(i)->getLayerInput()->get(inputs[j]);
+                if (!tensor || tensor->getSize() == 0) { continue; }
+
+                const Collection<size_t> &dims = tensor->getDimensions();
+                if (dims.size() > 6)
+                {
+                    throw std::runtime_error("Model tensor has too many dimensions");
+                }
+
+                ModelFileTensor entry;
+                memset(&entry, 0, sizeof(entry));
+                entry.layer = i;
+                entry.input = inputs[j];
+                entry.numOfDims = dims.size();
+                for (size_t k = 0; k < dims.size(); k++)
+                {
+                    entry.dims[k] = dims[k];
+                }
+                entries.push_back(entry);
+                tensors.push_back(tensor);
+            }
+        }
+
+        ModelFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "LENETMD", 8);
+        header.version = VERSION;
+        header.typeSize = sizeof(FPType);
+        header.batchSize = batchSize;
+        for (size_t i = 0; i < 3 && i < objectDims.size(); i++)
+        {
+            header.objectDims[i] = objectDims[i];
+        }
+        header.numOfLayers = forwardLayers->size();
+        header.numOfTensors = entries.size();
+
+        size_t offset = align(sizeof(header) + entries.size() * sizeof(ModelFileTensor));
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            entries[i].offset = offset;
+            offset = align(offset + tensors[i]->getSize() * sizeof(FPType));
+        }
+
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".tmp%ld", (long)getpid());
+        std::string tmpPath = _path + suffix;
+        std::ofstream stream(tmpPath.c_str(), std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+        if (!stream.good())
+        {
+            throw std::runtime_error("Unable to create model file " + tmpPath);
+        }
+
+        stream.write((const char *)&header, sizeof(header));
+        if (!entries.empty())
+        {
+            stream.write((const char *)&entries[0], entries.size() * sizeof(ModelFileTensor));
+        }
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            pad(stream, entries[i].offset);
+
+            SubtensorDescriptor<FPType> block;
+            tensors[i]->getSubtensor(0, 0, 0, tensors[i]->getDimensionSize(0), readOnly, block);
+            stream.write((const char *)block.getPtr(), block.getSize() * sizeof(FPType));
+            tensors[i]->releaseSubtensor(block);
+        }
+        stream.close();
+
+        if (stream.fail() || rename(tmpPath.c_str(), _path.c_str()) != 0)
+        {
+            remove(tmpPath.c_str());
+            throw std::runtime_error("Unable to write model file " + _path);
+        }
+    }
+
+    /* Builds a prediction model of the given topology whose weights and biases are tensors over
+       the mapped file, so that loading costs a page fault per touched page instead of a copy */
+    prediction::ModelPtr load(const prediction::TopologyPtr &topology)
+    {
+        SharedPtr<MappedFile> file(new MappedFile(_path, true));
+
+        if (file->size() < sizeof(ModelFileHeader))
+        {
+            throw std::runtime_error("File " + _path + " is not a LeNet model");
+        }
+        memcpy(&_header, file->data(), sizeof(_header));
+        if (memcmp(_header.magic, "LENETMD", 8) != 0 || _header.version != VERSION)
+        {
+            throw std::runtime_error("File " + _path + " has an unsupported model version");
+        }
+        if (_header.typeSize != sizeof(FPType))
+        {
+            throw std::runtime_error("Model " + _path + " was saved with another floating-point type");
+        }
+        if (file->size() < sizeof(ModelFileHeader) + _header.numOfTensors * sizeof(ModelFileTensor))
+        {
+            throw std::runtime_error("Model file " + _path + " is truncated");
+        }
+
+        prediction::ModelPtr model(new prediction::Model(*topology));
+        model->template allocate<FPType>(getDataDimensions(_header.batchSize));
+
+        SharedPtr<ForwardLayers> forwardLayers = model->getLayers();
+        if (forwardLayers->size() != _header.numOfLayers)
+        {
+            throw std::runtime_error("Model " + _path + " does not match the network topology");
+        }
+
+        const ModelFileTensor *entries = (const ModelFileTensor *)(file->data() + sizeof(ModelFileHeader));
+        for (size_t i = 0; i < _header.numOfTensors; i++)
+        {
+            const ModelFileTensor &entry = entries[i];
+
+            Collection<size_t> dims;
+            size_t size = 1;
+            for (size_t k = 0; k < entry.numOfDims && k < 6; k++)
+            {
+                dims.push_back(entry.dims[k]);
+                size *= entry.dims[k];
+            }
+            if (entry.layer >= forwardLayers->size() || entry.offset % ALIGNMENT != 0 ||
+                entry.offset + size * sizeof(FPType) > file->size())
+            {
+                throw std::runtime_error("Model file " + _path + " is corrupted");
+            }
+
+            layers::forward::InputId input = (layers::forward::InputId)entry.input;
+            layers::forward::Input *layerInput = forwardLayers->get(entry.layer)->getLayerInput();
+
+            /* Tensors allocated from the topology must agree with the saved shapes */
+            TensorPtr allocated = layerInput->get(input);
+            if (allocated && allocated->getSize() != 0 && allocated->getSize() != size)
+            {
+                throw std::runtime_error("Model " + _path + " does not match the network topology");
+            }
+
+            FPType *ptr = (FPType *)(file->data() + entry.offset);
+            layerInput->set(input, SharedPtr<HomogenTensor<FPType> >(new HomogenTensor<FPType>(dims, ptr),
+                                                                     MappedTensorDeleter<FPType>(file)));
+        }
+
+        return model;
+    }
+
+    /* Header of the last loaded model */
+    inline const ModelFileHeader &getHeader() { return _header; }
+
+    /* Dimensions of n objects of the shape the model was trained on */
+    Collection<size_t> getDataDimensions(size_t n)
+    {
+        Collection<size_t> dims;
+        dims.push_back(n);
+        for (size_t i = 0; i < 3; i++)
+        {
+            dims.push_back(_header.objectDims[i]);
+        }
+        return dims;
+    }
+
+private:
+
+    static inline size_t align(size_t offset)
+    {
+        return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    static void pad(std::ofstream &stream, size_t offset)
+    {
+        static const char zeros[ALIGNMENT] = { 0 };
+        size_t position = (size_t)stream.tellp();
+        if (offset > position)
+        {
+            stream.write(zeros, offset - position);
+        }
+    }
+
+    std::string _path;
+    ModelFileHeader _header;
+};
+
+#endif
@@ -21,51 +21,73 @@ using namespace daal::data_management;
 #include <cstdarg>
 #include <vector>
 #include <queue>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
 
 #include "error_handling.h"
 
 using namespace std;
 
+template<typename FPType>
 void printPredictedClasses(SharedPtr<prediction::Result> _predictionResult, TensorPtr _testingGroundTruth);
 void printWeights(SharedPtr<prediction::Model> _predictionModel);
 void printTensorAsArray(const TensorPtr &tensor, size_t size = 0);
 void printTensorAsArray(const TensorPtr &tensor, size_t m, size_t n, size_t offset = 0);
 bool checkFileIsAvailable(std::string filename, bool needExit = false);
 void checkArguments(int argc, char *argv[], int count, ...);
+bool getOption(int &argc, char *argv[], const std::string &name, std::string &value);
+bool getFlagOption(int &argc, char *argv[], const std::string &name);
+size_t getSizeOption(int &argc, char *argv[], const std::string &name, size_t defaultValue, size_t minValue = 0);
+double getDoubleOption(int &argc, char *argv[], const std::string &name, double defaultValue);
+std::string getStringOption(int &argc, char *argv[], const std::string &name, const std::string &defaultValue);
+std::vector<std::string> parseList(const std::string &list);
+std::vector<size_t> parseSizeList(const std::string &list, size_t minValue = 0);
+std::vector<double> parseDoubleList(const std::string &list);
 
+template<typename FPType>
 void printPredictedClasses(SharedPtr<prediction::Result> _predictionResult, TensorPtr _testingGroundTruth)
 {
     TensorPtr prediction = _predictionResult->get(prediction::prediction);
     const Collection<size_t> &predictionDimensions = prediction->getDimensions();
 
-    SubtensorDescriptor<double> predictionBlock;
+    SubtensorDescriptor<FPType> predictionBlock;
     prediction->getSubtensor(0, 0, 0, predictionDimensions[0], readOnly, predictionBlock);
-    double *predictionPtr = predictionBlock.getPtr();
+    FPType *predictionPtr = predictionBlock.getPtr();
 
     SubtensorDescriptor<int> testGroundTruthBlock;
     _testingGroundTruth->getSubtensor(0, 0, 0, predictionDimensions[0], readOnly, testGroundTruthBlock);
     int *testGroundTruthPtr = testGroundTruthBlock.getPtr();
 
-    // Print predicted classes
+    // Print predicted classes, rows are formatted into a buffer written once per 64 KB
+    const size_t flushSize = 1 << 16;
+    std::string buffer;
+    buffer.reserve(flushSize + 256);
+    char text[64];
     for (size_t i = 0; i < predictionDimensions[0]; i++)
     {
-        double maxP = 0;
+        FPType maxP = 0;
         size_t maxPIndex = 0;
         for (size_t j = 0; j < predictionDimensions[1]; j++)
         {
-            double p = predictionPtr[i * predictionDimensions[1] + j];
+            FPType p = predictionPtr[i * predictionDimensions[1] + j];
             if (maxP < p)
             {
                 maxP = p;
                 maxPIndex = j;
             }
-            printf("%.4f ", p);
+            buffer.append(text, snprintf(text, sizeof(text), "%.4f ", (double)p));
         }
-        fflush(stdout);
 
-        printf(" -> %d | %d\n", maxPIndex, testGroundTruthPtr[i]);
-        fflush(stdout);
+        buffer.append(text, snprintf(text, sizeof(text), " -> %d | %d\n", (int)maxPIndex, testGroundTruthPtr[i]));
+        if (buffer.size() >= flushSize)
+        {
+            fwrite(buffer.data(), 1, buffer.size(), stdout);
+            buffer.clear();
+        }
     }
+    fwrite(buffer.data(), 1, buffer.size(), stdout);
+    fflush(stdout);
 
     prediction->releaseSubtensor(predictionBlock);
     _testingGroundTruth->releaseSubtensor(testGroundTruthBlock);
@@ -212,3 +234,138 @@ void checkArguments(int argc, char *argv[], int count, ...)
     }
     delete [] filelist;
 }
+
+/* Finds "--name" or "--name=value" in the command line and removes it from argv,
+   so that the remaining positional arguments can be passed to checkArguments */
+bool getOption(int &argc, char *argv[], const std::string &name, std::string &value)
+{
+    const std::string key = "--" + name;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument(argv[i]);
+        if (argument != key && argument.compare(0, key.size() + 1, key + "=") != 0)
+        {
+            continue;
+        }
+
+        value = (argument.size() > key.size()) ? argument.substr(key.size() + 1) : std::string();
+        for (int j = i; j < argc - 1; j++)
+        {
+            argv[j] = argv[j + 1];
+        }
+        argc--;
+        return true;
+    }
+    return false;
+}
+
+bool getFlagOption(int &argc, char *argv[], const std::string &name)
+{
+    std::string value;
+    return getOption(argc, argv, name, value);
+}
+
+/* Ends the program on a malformed option, source is the option or list the value came from */
+void optionValueError(const std::string &source, const std::string &value, const std::string &expected)
+{
+    std::cout << "Error: '" << value << "' of " << source << " is not " << expected << std::endl;
+    exit(-1);
+}
+
+/* Whole decimal number of at least minValue */
+size_t parseSize(const std::string &source, const std::string &value, size_t minValue)
+{
+    char *end = NULL;
+    errno = 0;
+    const unsigned long long size = strtoull(value.c_str(), &end, 10);
+    if (value.empty() || !isdigit((unsigned char)value[0]) || *end != '\0' || errno == ERANGE)
+    {
+        optionValueError(source, value, "a whole number");
+    }
+    if (size < minValue)
+    {
+        std::stringstream expected;
+        expected << "at least " << minValue;
+        optionValueError(source, value, expected.str());
+    }
+    return (size_t)size;
+}
+
+double parseDouble(const std::string &source, const std::string &value)
+{
+    char *end = NULL;
+    const double number = strtod(value.c_str(), &end);
+    if (value.empty() || *end != '\0')
+    {
+        optionValueError(source, value, "a number");
+    }
+    return number;
+}
+
+size_t getSizeOption(int &argc, char *argv[], const std::string &name, size_t defaultValue, size_t minValue)
+{
+    std::string value;
+    if (!getOption(argc, argv, name, value) || value.empty())
+    {
+        return defaultValue;
+    }
+    return parseSize("--" + name, value, minValue);
+}
+
+double getDoubleOption(int &argc, char *argv[], const std::string &name, double defaultValue)
+{
+    std::string value;
+    if (!getOption(argc, argv, name, value) || value.empty())
+    {
+        return defaultValue;
+    }
+    return parseDouble("--" + name, value);
+}
+
+std::string getStringOption(int &argc, char *argv[], const std::string &name, const std::string &defaultValue)
+{
+    std::string value;
+    if (!getOption(argc, argv, name, value) || value.empty())
+    {
+        return defaultValue;
+    }
+    return value;
+}
+
+/* Items of a comma-separated option value, empty items are skipped */
+std::vector<std::string> parseList(const std::string &list)
+{
+    std::vector<std::string> values;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+        {
+            values.push_back(item);
+        }
+    }
+    return values;
+}
+
+std::vector<size_t> parseSizeList(const std::string &list, size_t minValue)
+{
+    std::vector<std::string> items = parseList(list);
+    std::vector<size_t> values;
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        values.push_back(parseSize("'" + list + "'", items[i], minValue));
+    }
+    return values;
+}
+
+std::vector<double> parseDoubleList(const std::string &list)
+{
+    std::vector<std::string> items = parseList(list);
+    std::vector<double> values;
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        values.push_back(parseDouble("'" + list + "'", items[i]));
+    }
+    return values;
+}
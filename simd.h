@@ -0,0 +1,63 @@
+/* file: simd.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    SSE2 vector traits shared by the native kernels and the evaluation of predictions
+!******************************************************************************/
+
+#ifndef _SIMD_H
+#define _SIMD_H
+
+#include <cstddef>
+#include <emmintrin.h>
+
+/* SSE2 vectors of FPType with the operations the native kernels and the evaluation need */
+template<typename FPType>
+struct Simd;
+
+template<>
+struct Simd<float>
+{
+    typedef __m128 Vector;
+    static const size_t width = 4;
+    static inline Vector zero() { return _mm_setzero_ps(); }
+    static inline Vector set1(float a) { return _mm_set1_ps(a); }
+    static inline Vector load(const float *p) { return _mm_loadu_ps(p); }
+    static inline void store(float *p, Vector a) { _mm_storeu_ps(p, a); }
+    static inline Vector add(Vector a, Vector b) { return _mm_add_ps(a, b); }
+    static inline Vector mul(Vector a, Vector b) { return _mm_mul_ps(a, b); }
+    static inline Vector max(Vector a, Vector b) { return _mm_max_ps(a, b); }
+    /* Bit i of the result is set if a[i] > b[i] */
+    static inline int greater(Vector a, Vector b) { return _mm_movemask_ps(_mm_cmpgt_ps(a, b)); }
+    static inline float maxElement(Vector a)
+    {
+        a = _mm_max_ps(a, _mm_movehl_ps(a, a));
+        a = _mm_max_ss(a, _mm_shuffle_ps(a, a, 1));
+        return _mm_cvtss_f32(a);
+    }
+};
+
+template<>
+struct Simd<double>
+{
+    typedef __m128d Vector;
+    static const size_t width = 2;
+    static inline Vector zero() { return _mm_setzero_pd(); }
+    static inline Vector set1(double a) { return _mm_set1_pd(a); }
+    static inline Vector load(const double *p) { return _mm_loadu_pd(p); }
+    static inline void store(double *p, Vector a) { _mm_storeu_pd(p, a); }
+    static inline Vector add(Vector a, Vector b) { return _mm_add_pd(a, b); }
+    static inline Vector mul(Vector a, Vector b) { return _mm_mul_pd(a, b); }
+    static inline Vector max(Vector a, Vector b) { return _mm_max_pd(a, b); }
+    static inline int greater(Vector a, Vector b) { return _mm_movemask_pd(_mm_cmpgt_pd(a, b)); }
+    static inline double maxElement(Vector a) { return _mm_cvtsd_f64(_mm_max_sd(a, _mm_unpackhi_pd(a, a))); }
+};
+
+#endif
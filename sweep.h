@@ -0,0 +1,175 @@
+/* file: sweep.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Hyperparameter sweep: LeNet configurations trained and tested concurrently on one
+!    resident dataset, each in a TBB arena with its share of the cores
+!******************************************************************************/
+
+#ifndef _SWEEP_H
+#define _SWEEP_H
+
+#include "lenet_pipeline.h"
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <tbb/task_arena.h>
+
+struct SweepConfiguration
+{
+    double learningRate;
+    size_t batchSize;
+    /* Kernels of the two convolutions, 0 keeps the topology of the base parameters */
+    size_t kernels1;
+    size_t kernels2;
+};
+
+struct SweepResult
+{
+    SweepConfiguration configuration;
+    size_t numOfThreads;
+    double trainTime;
+    double testTime;
+    Evaluation evaluation;
+    /* Message of the exception that stopped the configuration, empty if it finished */
+    std::string error;
+};
+
+/* Every combination of the values */
+inline std::vector<SweepConfiguration> makeSweepGrid(const std::vector<double> &learningRates,
+                                                     const std::vector<size_t> &batchSizes,
+                                                     const std::vector<std::pair<size_t, size_t> > &kernels)
+{
+    std::vector<SweepConfiguration> configurations;
+    for (size_t i = 0; i < learningRates.size(); i++)
+    {
+        for (size_t j = 0; j < batchSizes.size(); j++)
+        {
+            for (size_t k = 0; k < kernels.size(); k++)
+            {
+                SweepConfiguration configuration = { learningRates[i], batchSizes[j], kernels[k].first, kernels[k].second };
+                configurations.push_back(configuration);
+            }
+        }
+    }
+    return configurations;
+}
+
+/* Runs numOfJobs configurations at a time. The train and test tensors are only read, so all
+   configurations share one copy of them. The cores are split evenly between the jobs, a job
+   runs the DAAL and TBB work of its configuration in an arena of its share */
+template<typename FPType>
+std::vector<SweepResult> runSweep(const TensorPtr &trainingData, const TensorPtr &trainingGroundTruth,
+                                  const TensorPtr &testingData, const TensorPtr &testingGroundTruth,
+                                  const TrainingParameters &baseParameters,
+                                  const std::vector<SweepConfiguration> &configurations,
+                                  size_t numOfJobs, size_t numOfThreads, size_t maxK = 1)
+{
+    std::vector<SweepResult> results(configurations.size());
+    numOfJobs = std::max<size_t>(std::min(numOfJobs, configurations.size()), 1);
+    numOfThreads = std::max(numOfThreads, numOfJobs);
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> jobs;
+    for (size_t job = 0; job < numOfJobs; job++)
+    {
+        const size_t jobThreads = numOfThreads / numOfJobs + (job < numOfThreads % numOfJobs ? 1 : 0);
+        jobs.push_back(std::thread([&, jobThreads]()
+        {
+            tbb::task_arena arena((int)jobThreads);
+            for (size_t i = next++; i < configurations.size(); i = next++)
+            {
+                SweepResult &result = results[i];
+                result.configuration = configurations[i];
+                result.numOfThreads = jobThreads;
+                result.trainTime = result.testTime = 0;
+
+                TrainingParameters parameters = baseParameters;
+                parameters.learningRate = configurations[i].learningRate;
+                parameters.batchSize = configurations[i].batchSize;
+                parameters.verbose = false;
+                /* Checkpoints of concurrent configurations would overwrite each other */
+                parameters.checkpointDirectory.clear();
+                if (configurations[i].kernels1 > 0 && configurations[i].kernels2 > 0)
+                {
+                    parameters.topology = SharedPtr<TopologyConfig>(new TopologyConfig(
+                        TopologyConfig::lenet(configurations[i].kernels1, configurations[i].kernels2)));
+                }
+
+                try
+                {
+                    arena.execute([&]()
+                    {
+                        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                        prediction::ModelPtr model = trainModel<FPType>(trainingData, trainingGroundTruth, parameters);
+                        result.trainTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                        start = std::chrono::steady_clock::now();
+                        prediction::ResultPtr prediction = predict<FPType>(model, testingData);
+                        result.evaluation = evaluate<FPType>(prediction, testingGroundTruth, maxK);
+                        result.testTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    });
+                }
+                catch (std::exception &e)
+                {
+                    result.error = e.what();
+                }
+            }
+        }));
+    }
+    for (size_t job = 0; job < jobs.size(); job++)
+    {
+        jobs[job].join();
+    }
+    return results;
+}
+
+/* Results from the most to the least accurate, ties go to the lower loss. Failed configurations come last */
+inline void printSweepResults(std::vector<SweepResult> results, size_t numOfTrainObjects, size_t numberOfEpochs)
+{
+    std::stable_sort(results.begin(), results.end(), [](const SweepResult &a, const SweepResult &b)
+    {
+        if (a.error.empty() != b.error.empty()) { return a.error.empty(); }
+        if (a.evaluation.getAccuracy() != b.evaluation.getAccuracy())
+        {
+            return a.evaluation.getAccuracy() > b.evaluation.getAccuracy();
+        }
+        return a.evaluation.getLoss() < b.evaluation.getLoss();
+    });
+
+    printf("Rank  Learning rate  Batch  Kernels  Threads  Accuracy    Loss  Train s  Train images/s  Test s\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const SweepResult &r = results[i];
+        char kernels[32];
+        if (r.configuration.kernels1 > 0 && r.configuration.kernels2 > 0)
+        {
+            snprintf(kernels, sizeof(kernels), "%lux%lu", (unsigned long)r.configuration.kernels1, (unsigned long)r.configuration.kernels2);
+        }
+        else
+        {
+            snprintf(kernels, sizeof(kernels), "-");
+        }
+
+        printf("%4lu %14g %6lu %8s %8lu", (unsigned long)(i + 1), r.configuration.learningRate,
+               (unsigned long)r.configuration.batchSize, kernels, (unsigned long)r.numOfThreads);
+        if (!r.error.empty())
+        {
+            printf("  failed: %s\n", r.error.c_str());
+            continue;
+        }
+        printf(" %9.4f %7.4f %8.3f %15.0f %7.3f\n", r.evaluation.getAccuracy(), r.evaluation.getLoss(), r.trainTime,
+               r.trainTime > 0 ? numOfTrainObjects * numberOfEpochs / r.trainTime : 0.0, r.testTime);
+    }
+}
+
+#endif
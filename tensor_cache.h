@@ -0,0 +1,224 @@
+/* file: tensor_cache.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Binary cache of preprocessed dataset tensors that are mapped back without decoding
+!******************************************************************************/
+
+#ifndef _TENSOR_CACHE_H
+#define _TENSOR_CACHE_H
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include "daal.h"
+#include "mapped_file.h"
+
+using namespace daal;
+using namespace daal::services;
+using namespace daal::data_management;
+
+/* Layout of a cache file: header, then NCHW data and labels, each starting at a page boundary.
+   Any field that differs from the expected header makes the cache stale */
+struct TensorCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t typeSize;
+    uint64_t dims[4];
+    uint64_t margins;
+    char normalizer[128];
+    uint64_t sourceDataSize;
+    int64_t sourceDataTime;
+    uint64_t sourceLabelsSize;
+    int64_t sourceLabelsTime;
+    uint64_t dataOffset;
+    uint64_t labelsOffset;
+};
+
+/* Keeps the mapping alive for as long as a tensor refers to it */
+template<typename FPType>
+class MappedTensorDeleter
+{
+public:
+    MappedTensorDeleter(const SharedPtr<MappedFile> &file) : _file(file) { }
+
+    void operator()(const void *ptr)
+    {
+        delete (const HomogenTensor<FPType> *)ptr;
+        _file = SharedPtr<MappedFile>();
+    }
+
+private:
+    SharedPtr<MappedFile> _file;
+};
+
+template<typename FPType>
+class TensorCache
+{
+public:
+
+    static const uint32_t VERSION = 1;
+    static const size_t ALIGNMENT = 4096;
+
+    TensorCache(const std::string &path) : _path(path) { }
+
+    /* Describes the cache expected for the given source files and preprocessing */
+    TensorCacheHeader makeHeader(const Collection<size_t> &dims, size_t margins, const std::string &normalizer,
+                                 const std::string &dataPath, const std::string &labelsPath)
+    {
+        TensorCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "LENETTC", 8);
+        header.version = VERSION;
+        header.typeSize = sizeof(FPType);
+        for (size_t i = 0; i < 4 && i < dims.size(); i++)
+        {
+            header.dims[i] = dims[i];
+        }
+        header.margins = margins;
+        strncpy(header.normalizer, normalizer.c_str(), sizeof(header.normalizer) - 1);
+        fileSignature(dataPath, header.sourceDataSize, header.sourceDataTime);
+        fileSignature(labelsPath, header.sourceLabelsSize, header.sourceLabelsTime);
+
+        size_t dataSize = header.dims[0] * header.dims[1] * header.dims[2] * header.dims[3] * sizeof(FPType);
+        header.dataOffset = align(sizeof(TensorCacheHeader));
+        header.labelsOffset = align(header.dataOffset + dataSize);
+        return header;
+    }
+
+    /* Maps the cache into tensors, returns false if it is missing or does not match the header */
+    bool load(const TensorCacheHeader &expected,
+              SharedPtr<HomogenTensor<FPType> > &data, SharedPtr<HomogenTensor<FPType> > &labels)
+    {
+        struct stat cacheStat;
+        if (stat(_path.c_str(), &cacheStat) != 0)
+        {
+            return false;
+        }
+
+        SharedPtr<MappedFile> file(new MappedFile(_path, true));
+
+        size_t numOfObjects = expected.dims[0];
+        if (file->size() < expected.labelsOffset + numOfObjects * sizeof(FPType) ||
+            memcmp(file->data(), &expected, sizeof(TensorCacheHeader)) != 0)
+        {
+            return false;
+        }
+
+        Collection<size_t> dataDims;
+        for (size_t i = 0; i < 4; i++)
+        {
+            dataDims.push_back(expected.dims[i]);
+        }
+        Collection<size_t> labelsDims;
+        labelsDims.push_back(numOfObjects);
+
+        FPType *dataPtr = (FPType *)(file->data() + expected.dataOffset);
+        FPType *labelsPtr = (FPType *)(file->data() + expected.labelsOffset);
+
+        data = SharedPtr<HomogenTensor<FPType> >(new HomogenTensor<FPType>(dataDims, dataPtr),
+                                                 MappedTensorDeleter<FPType>(file));
+        labels = SharedPtr<HomogenTensor<FPType> >(new HomogenTensor<FPType>(labelsDims, labelsPtr),
+                                                   MappedTensorDeleter<FPType>(file));
+        return true;
+    }
+
+    /* Writes the cache through a temporary file, so that concurrent readers never see it half written.
+       The temporary file is private to the process, several processes may build the same cache at once.
+       The cache directory and its parents are created if missing */
+    void save(const TensorCacheHeader &header,
+              const SharedPtr<HomogenTensor<FPType> > &data, const SharedPtr<HomogenTensor<FPType> > &labels)
+    {
+        const size_t directoryEnd = _path.find_last_of('/');
+        if (directoryEnd != std::string::npos)
+        {
+            createDirectory(_path.substr(0, directoryEnd));
+        }
+
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".tmp%ld", (long)getpid());
+        std::string tmpPath = _path + suffix;
+        std::ofstream stream(tmpPath.c_str(), std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+        if (!stream.good())
+        {
+            throw std::runtime_error("Unable to create cache file " + tmpPath);
+        }
+
+        stream.write((const char *)&header, sizeof(header));
+        pad(stream, header.dataOffset);
+        stream.write((const char *)data->getArray(), data->getSize() * sizeof(FPType));
+        pad(stream, header.labelsOffset);
+        stream.write((const char *)labels->getArray(), labels->getSize() * sizeof(FPType));
+        stream.close();
+
+        if (stream.fail() || rename(tmpPath.c_str(), _path.c_str()) != 0)
+        {
+            remove(tmpPath.c_str());
+            throw std::runtime_error("Unable to write cache file " + _path);
+        }
+    }
+
+    inline const std::string &getPath() { return _path; }
+
+private:
+
+    static void createDirectory(const std::string &directory)
+    {
+        for (size_t end = directory.find('/', 1); ; end = directory.find('/', end + 1))
+        {
+            const std::string path = directory.substr(0, end);
+            if (!path.empty() && mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+            {
+                throw std::runtime_error("Unable to create cache directory " + path + ": " + strerror(errno));
+            }
+            if (end == std::string::npos)
+            {
+                break;
+            }
+        }
+    }
+
+    static inline size_t align(size_t offset)
+    {
+        return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    static void pad(std::ofstream &stream, size_t offset)
+    {
+        static const char zeros[ALIGNMENT] = { 0 };
+        size_t position = (size_t)stream.tellp();
+        if (offset > position)
+        {
+            stream.write(zeros, offset - position);
+        }
+    }
+
+    static void fileSignature(const std::string &path, uint64_t &size, int64_t &time)
+    {
+        struct stat fileStat;
+        if (stat(path.c_str(), &fileStat) != 0)
+        {
+            throw std::runtime_error("Unable to open file " + path);
+        }
+        size = (uint64_t)fileStat.st_size;
+        time = (int64_t)fileStat.st_mtime;
+    }
+
+    std::string _path;
+};
+
+#endif
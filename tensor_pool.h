@@ -0,0 +1,277 @@
+/* file: tensor_pool.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Pool of 64-byte aligned buffers for the tensors of the sample, large buffers on
+!    transparent huge pages, recycled across minibatches, evaluations and runs
+!******************************************************************************/
+
+#ifndef _TENSOR_POOL_H
+#define _TENSOR_POOL_H
+
+#include <map>
+#include <mutex>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <stdexcept>
+#include <sys/mman.h>
+#include "daal.h"
+#include "instrumentation.h"
+
+using namespace daal;
+using namespace daal::services;
+using namespace daal::data_management;
+
+/* Freed buffers are kept by capacity and handed out again for requests of at least half their
+   capacity. Buffers of HUGE_PAGE_SIZE and more are mapped at a huge page boundary and advised
+   to the kernel as huge page candidates, smaller ones come from posix_memalign */
+class TensorPool
+{
+public:
+
+    static const size_t ALIGNMENT = 64;
+    static const size_t BASE_PAGE_SIZE = 4096;
+    static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    struct Statistics
+    {
+        size_t numOfRequests;
+        size_t numOfReuses;
+        size_t requestedBytes;
+        /* Memory obtained from the system */
+        size_t numOfSystemAllocations;
+        size_t systemBytes;
+        /* Free buffers held for reuse */
+        size_t cachedBytes;
+        size_t peakCachedBytes;
+    };
+
+    /* Never destroyed, tensors held by static objects may be released after the end of main */
+    static TensorPool &getInstance()
+    {
+        static TensorPool *pool = new TensorPool();
+        return *pool;
+    }
+
+    /* Returns a buffer of at least bytes and its capacity, fresh tells whether its pages are untouched */
+    void *acquire(size_t bytes, size_t &capacity, bool *fresh = NULL)
+    {
+        capacity = roundCapacity(std::max<size_t>(bytes, 1));
+        void *ptr = NULL;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _statistics.numOfRequests++;
+            _statistics.requestedBytes += bytes;
+
+            std::multimap<size_t, void *>::iterator it = _free.lower_bound(capacity);
+            if (it != _free.end() && it->first <= 2 * capacity)
+            {
+                capacity = it->first;
+                ptr = it->second;
+                _free.erase(it);
+                _statistics.cachedBytes -= capacity;
+                _statistics.numOfReuses++;
+            }
+        }
+
+        if (fresh) { *fresh = (ptr == NULL); }
+        if (ptr)
+        {
+            Profiler::getInstance().addAllocation("pool: reused buffers", capacity);
+            return ptr;
+        }
+
+        ptr = allocate(capacity);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _statistics.numOfSystemAllocations++;
+            _statistics.systemBytes += capacity;
+        }
+        Profiler::getInstance().addAllocation("pool: new buffers", capacity);
+        return ptr;
+    }
+
+    /* Takes a buffer back, it is returned to the system if the cache would exceed its limit */
+    void release(void *ptr, size_t capacity)
+    {
+        if (!ptr) { return; }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_statistics.cachedBytes + capacity <= _cacheLimit)
+            {
+                _free.insert(std::make_pair(capacity, ptr));
+                _statistics.cachedBytes += capacity;
+                _statistics.peakCachedBytes = std::max(_statistics.peakCachedBytes, _statistics.cachedBytes);
+                return;
+            }
+        }
+        deallocate(ptr, capacity);
+    }
+
+    /* Largest total size of the free buffers kept for reuse */
+    void setCacheLimit(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _cacheLimit = bytes;
+    }
+
+    /* Returns all free buffers to the system */
+    void trim()
+    {
+        std::multimap<size_t, void *> buffers;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            buffers.swap(_free);
+            _statistics.cachedBytes = 0;
+        }
+        for (std::multimap<size_t, void *>::iterator it = buffers.begin(); it != buffers.end(); ++it)
+        {
+            deallocate(it->second, it->first);
+        }
+    }
+
+    Statistics getStatistics()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _statistics;
+    }
+
+    void print()
+    {
+        Statistics s = getStatistics();
+        printf("Tensor pool: %lu requests for %.1f MB, %lu served from the pool (%.1f%%), %lu system allocations of %.1f MB, "
+               "%.1f MB cached (peak %.1f MB)\n",
+               (unsigned long)s.numOfRequests, s.requestedBytes / (1024.0 * 1024.0), (unsigned long)s.numOfReuses,
+               s.numOfRequests ? 100.0 * s.numOfReuses / s.numOfRequests : 0.0, (unsigned long)s.numOfSystemAllocations,
+               s.systemBytes / (1024.0 * 1024.0), s.cachedBytes / (1024.0 * 1024.0), s.peakCachedBytes / (1024.0 * 1024.0));
+    }
+
+private:
+
+    TensorPool() : _cacheLimit((size_t)1 << 30)
+    {
+        Statistics empty = { 0, 0, 0, 0, 0, 0, 0 };
+        _statistics = empty;
+    }
+
+    static size_t roundCapacity(size_t bytes)
+    {
+        const size_t unit = bytes >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : bytes >= BASE_PAGE_SIZE ? BASE_PAGE_SIZE : ALIGNMENT;
+        return (bytes + unit - 1) / unit * unit;
+    }
+
+    static void *allocate(size_t capacity)
+    {
+        if (capacity < HUGE_PAGE_SIZE)
+        {
+            void *ptr = NULL;
+            if (posix_memalign(&ptr, ALIGNMENT, capacity) != 0)
+            {
+                throw std::runtime_error("Tensor pool is out of memory");
+            }
+            return ptr;
+        }
+
+        /* Mapped with a huge page of slack, then trimmed to start at a huge page boundary */
+        const size_t mappedSize = capacity + HUGE_PAGE_SIZE;
+        char *mapped = (char *)mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED)
+        {
+            throw std::runtime_error("Tensor pool is out of memory");
+        }
+        char *aligned = (char *)(((uintptr_t)mapped + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+        if (aligned > mapped)
+        {
+            munmap(mapped, aligned - mapped);
+        }
+        if (aligned + capacity < mapped + mappedSize)
+        {
+            munmap(aligned + capacity, mapped + mappedSize - (aligned + capacity));
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(aligned, capacity, MADV_HUGEPAGE);
+#endif
+        return aligned;
+    }
+
+    static void deallocate(void *ptr, size_t capacity)
+    {
+        if (capacity < HUGE_PAGE_SIZE)
+        {
+            free(ptr);
+        }
+        else
+        {
+            munmap(ptr, capacity);
+        }
+    }
+
+    TensorPool(const TensorPool &);
+    TensorPool &operator=(const TensorPool &);
+
+    std::mutex _mutex;
+    std::multimap<size_t, void *> _free;
+    size_t _cacheLimit;
+    Statistics _statistics;
+};
+
+/* Gives the buffer of a pooled tensor back to the pool with the tensor */
+template<typename T>
+class PooledTensorDeleter
+{
+public:
+    PooledTensorDeleter(void *buffer, size_t capacity) : _buffer(buffer), _capacity(capacity) { }
+
+    void operator()(const void *ptr)
+    {
+        delete (const HomogenTensor<T> *)ptr;
+        TensorPool::getInstance().release(_buffer, _capacity);
+    }
+
+private:
+    void *_buffer;
+    size_t _capacity;
+};
+
+/* Tensor over a pooled buffer, its contents are undefined. fresh tells whether its pages are untouched,
+   e.g. to place them on NUMA nodes */
+template<typename T>
+SharedPtr<HomogenTensor<T> > makePooledTensor(const Collection<size_t> &dims, bool *fresh = NULL)
+{
+    size_t size = 1;
+    for (size_t i = 0; i < dims.size(); i++)
+    {
+        size *= dims[i];
+    }
+
+    size_t capacity = 0;
+    void *buffer = TensorPool::getInstance().acquire(size * sizeof(T), capacity, fresh);
+    return SharedPtr<HomogenTensor<T> >(new HomogenTensor<T>(dims, (T *)buffer), PooledTensorDeleter<T>(buffer, capacity));
+}
+
+/* Pooled scratch memory for the lifetime of a scope */
+class PooledBuffer
+{
+public:
+    PooledBuffer(size_t bytes) { _ptr = TensorPool::getInstance().acquire(bytes, _capacity); }
+    ~PooledBuffer() { TensorPool::getInstance().release(_ptr, _capacity); }
+
+    inline void *get() { return _ptr; }
+
+private:
+    PooledBuffer(const PooledBuffer &);
+    PooledBuffer &operator=(const PooledBuffer &);
+
+    void *_ptr;
+    size_t _capacity;
+};
+
+#endif
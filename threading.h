@@ -0,0 +1,238 @@
+/* file: threading.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    NUMA topology of the host, pinning of TBB threads to cores and placement of the pages
+!    of large buffers on the NUMA nodes, without a dependency on libnuma
+!******************************************************************************/
+
+#ifndef _THREADING_H
+#define _THREADING_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/partitioner.h>
+#include <tbb/task_scheduler_observer.h>
+
+/* Where the pages of the dataset tensors are placed.
+   placementInterleave spreads them round-robin over all nodes, so that threads of every node
+   read them at the same mean cost. placementLocal writes them first from all TBB threads with a
+   static partition, so that every page is on the node of the thread that later works on its range */
+enum MemoryPlacement
+{
+    placementDefault,
+    placementInterleave,
+    placementLocal
+};
+
+inline MemoryPlacement parseMemoryPlacement(const std::string &name)
+{
+    if (name == "default")    { return placementDefault; }
+    if (name == "interleave") { return placementInterleave; }
+    if (name == "local")      { return placementLocal; }
+    throw std::runtime_error("Unknown memory placement '" + name + "', use default, interleave or local");
+}
+
+inline const char *getMemoryPlacementName(MemoryPlacement placement)
+{
+    static const char *names[] = { "default", "interleave", "local" };
+    return names[placement];
+}
+
+/* CPU list of sysfs, e.g. "0-7,16-23" */
+inline std::vector<int> parseCpuList(const std::string &list)
+{
+    std::vector<int> cpus;
+    const char *p = list.c_str();
+    while (*p)
+    {
+        char *end = NULL;
+        long first = strtol(p, &end, 10);
+        if (end == p) { break; }
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++)
+        {
+            cpus.push_back((int)cpu);
+        }
+        while (*p == ',' || *p == '\n') { p++; }
+    }
+    return cpus;
+}
+
+inline std::string readLine(const std::string &path)
+{
+    std::string line;
+    FILE *file = fopen(path.c_str(), "r");
+    if (file)
+    {
+        char buffer[4096];
+        if (fgets(buffer, sizeof(buffer), file)) { line = buffer; }
+        fclose(file);
+    }
+    return line;
+}
+
+/* CPUs of every NUMA node, one node with all online CPUs if the kernel reports none */
+inline std::vector<std::vector<int> > getNumaNodes()
+{
+    std::vector<std::vector<int> > nodes;
+    std::vector<int> nodeIds = parseCpuList(readLine("/sys/devices/system/node/online"));
+    for (size_t i = 0; i < nodeIds.size(); i++)
+    {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodeIds[i]);
+        std::vector<int> cpus = parseCpuList(readLine(path));
+        if (!cpus.empty())
+        {
+            nodes.push_back(cpus);
+        }
+    }
+
+    if (nodes.empty())
+    {
+        std::vector<int> cpus;
+        const long numOfCpus = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long cpu = 0; cpu < numOfCpus; cpu++)
+        {
+            cpus.push_back((int)cpu);
+        }
+        nodes.push_back(cpus);
+    }
+    return nodes;
+}
+
+/* Pins every thread that joins TBB to its own CPU, in the order the threads first join.
+   compact fills the CPUs of a node before the next node, scatter alternates between the nodes */
+class ThreadPinner : public tbb::task_scheduler_observer
+{
+public:
+
+    ThreadPinner(const std::string &mode) : _next(0)
+    {
+        std::vector<std::vector<int> > nodes = getNumaNodes();
+        if (mode == "compact")
+        {
+            for (size_t n = 0; n < nodes.size(); n++)
+            {
+                _cpus.insert(_cpus.end(), nodes[n].begin(), nodes[n].end());
+            }
+        }
+        else if (mode == "scatter")
+        {
+            for (size_t i = 0, added = 1; added; i++)
+            {
+                added = 0;
+                for (size_t n = 0; n < nodes.size(); n++)
+                {
+                    if (i < nodes[n].size())
+                    {
+                        _cpus.push_back(nodes[n][i]);
+                        added++;
+                    }
+                }
+            }
+        }
+        else
+        {
+            throw std::runtime_error("Unknown affinity '" + mode + "', use none, compact or scatter");
+        }
+        observe(true);
+    }
+
+    virtual ~ThreadPinner() { observe(false); }
+
+    /* A thread enters again for every arena it joins, it keeps the CPU of its first entry */
+    virtual void on_scheduler_entry(bool /* isWorker */)
+    {
+        static thread_local const ThreadPinner *pinnedBy = NULL;
+        if (pinnedBy == this)
+        {
+            return;
+        }
+        pinnedBy = this;
+
+        const int cpu = _cpus[_next++ % _cpus.size()];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+private:
+    std::vector<int> _cpus;
+    std::atomic<size_t> _next;
+};
+
+/* Applies the placement to a buffer whose pages have not been written yet */
+inline void placeMemory(void *ptr, size_t bytes, MemoryPlacement placement)
+{
+    if (placement == placementDefault || bytes == 0)
+    {
+        return;
+    }
+
+    const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    const uintptr_t begin = ((uintptr_t)ptr + pageSize - 1) & ~(uintptr_t)(pageSize - 1);
+    const uintptr_t end = ((uintptr_t)ptr + bytes) & ~(uintptr_t)(pageSize - 1);
+    if (end <= begin)
+    {
+        return;
+    }
+
+    if (placement == placementInterleave)
+    {
+        /* mbind(2) with MPOL_INTERLEAVE over all nodes, MPOL_MF_MOVE also moves pages already written */
+        const int MPOL_INTERLEAVE_ = 3;
+        const unsigned MPOL_MF_MOVE_ = 1 << 1;
+        std::vector<int> nodeIds = parseCpuList(readLine("/sys/devices/system/node/online"));
+        if (nodeIds.size() < 2)
+        {
+            return;
+        }
+        const size_t bitsPerWord = 8 * sizeof(unsigned long);
+        std::vector<unsigned long> mask(nodeIds.back() / bitsPerWord + 1, 0);
+        for (size_t i = 0; i < nodeIds.size(); i++)
+        {
+            mask[nodeIds[i] / bitsPerWord] |= 1UL << (nodeIds[i] % bitsPerWord);
+        }
+        syscall(SYS_mbind, (void *)begin, end - begin, MPOL_INTERLEAVE_, &mask[0], mask.size() * bitsPerWord + 1, MPOL_MF_MOVE_);
+    }
+
+    /* First touch of every page by the threads that will process its range */
+    char *pages = (char *)begin;
+    const size_t numOfPages = (end - begin) / pageSize;
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, numOfPages), [&](const tbb::blocked_range<size_t> &range)
+    {
+        for (size_t i = range.begin(); i < range.end(); i++)
+        {
+            pages[i * pageSize] = 0;
+        }
+    }, tbb::static_partitioner());
+}
+
+#endif
@@ -0,0 +1,494 @@
+/* file: topology_config.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Network topology read from a text file, with shape inference and a memory plan
+!    of the layers for a given minibatch size
+!******************************************************************************/
+
+#ifndef _TOPOLOGY_CONFIG_H
+#define _TOPOLOGY_CONFIG_H
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include "daal.h"
+
+/* Topology file of the solution, kept out of the exercise sources */
+#ifndef LENET_TOPOLOGY
+#define LENET_TOPOLOGY "./solution/lenet.topology"
+#endif
+
+using namespace daal;
+using namespace daal::algorithms;
+using namespace daal::algorithms::neural_networks;
+using namespace daal::algorithms::neural_networks::layers;
+using namespace daal::services;
+using namespace daal::data_management;
+
+/* One layer of a topology file line, e.g. "convolution name=conv1 kernels=32 kernel=3 stride=1".
+   Sizes of two dimensions are given as one number or as HxW */
+struct LayerConfig
+{
+    enum Type { convolution, maxpooling, fullyconnected, relu, softmax };
+
+    Type type;
+    std::string name;
+    /* Output channels of convolution, outputs of fullyconnected */
+    size_t outputs;
+    size_t kernel[2];
+    size_t stride[2];
+    size_t padding[2];
+
+    LayerConfig() : type(relu), outputs(0)
+    {
+        kernel[0] = kernel[1] = 1;
+        stride[0] = stride[1] = 1;
+        padding[0] = padding[1] = 0;
+    }
+
+    static const char *getTypeName(Type type)
+    {
+        static const char *names[] = { "convolution", "maxpooling", "fullyconnected", "relu", "softmax" };
+        return names[type];
+    }
+};
+
+/* Shape and memory of one layer for a minibatch */
+struct LayerPlan
+{
+    std::string name;
+    LayerConfig::Type type;
+    /* Shape of one output object */
+    size_t outputDims[3];
+    size_t numOfParameters;
+    /* Forward values, backward gradients of the input and pooling indices */
+    size_t activationBytes;
+    /* Weights and biases with their derivatives */
+    size_t parameterBytes;
+};
+
+/* Memory of a network for one minibatch size. Activations grow with the minibatch size and
+   parameters do not, which gives the largest minibatch that fits into a budget */
+struct MemoryPlan
+{
+    size_t batchSize;
+    size_t inputBytes;
+    std::vector<LayerPlan> layers;
+
+    size_t getActivationBytes() const
+    {
+        size_t bytes = inputBytes;
+        for (size_t i = 0; i < layers.size(); i++)
+        {
+            bytes += layers[i].activationBytes;
+        }
+        return bytes;
+    }
+
+    size_t getParameterBytes() const
+    {
+        size_t bytes = 0;
+        for (size_t i = 0; i < layers.size(); i++)
+        {
+            bytes += layers[i].parameterBytes;
+        }
+        return bytes;
+    }
+
+    inline size_t getTotalBytes() const { return getActivationBytes() + getParameterBytes(); }
+
+    /* Largest minibatch whose plan fits into budgetBytes, 0 if the parameters alone do not fit */
+    size_t getMaxBatchSize(size_t budgetBytes) const
+    {
+        const size_t parameterBytes = getParameterBytes();
+        const size_t objectBytes = batchSize ? getActivationBytes() / batchSize : 0;
+        if (budgetBytes <= parameterBytes || objectBytes == 0)
+        {
+            return 0;
+        }
+        return (budgetBytes - parameterBytes) / objectBytes;
+    }
+
+    void print() const
+    {
+        printf("Layer            Type            Output            Parameters  Activations MB  Parameters MB\n");
+        for (size_t i = 0; i < layers.size(); i++)
+        {
+            const LayerPlan &l = layers[i];
+            char shape[64];
+            snprintf(shape, sizeof(shape), "%lux%lux%lu", (unsigned long)l.outputDims[0], (unsigned long)l.outputDims[1],
+                     (unsigned long)l.outputDims[2]);
+            printf("%-16s %-15s %-17s %10lu %15.2f %14.2f\n", l.name.c_str(), LayerConfig::getTypeName(l.type), shape,
+                   (unsigned long)l.numOfParameters, l.activationBytes / (1024.0 * 1024.0), l.parameterBytes / (1024.0 * 1024.0));
+        }
+        printf("Network memory for minibatches of %lu: %.2f MB, activations %.2f MB with the input, parameters %.2f MB\n",
+               (unsigned long)batchSize, getTotalBytes() / (1024.0 * 1024.0), getActivationBytes() / (1024.0 * 1024.0),
+               getParameterBytes() / (1024.0 * 1024.0));
+    }
+};
+
+/* Sequential topology, every layer gets the output of the preceding one as configureNet connects them.
+   Lines starting with # are comments, the last layer must be softmax, which is the softmax
+   cross-entropy loss in training and softmax in prediction. Weights are initialized as in configureNet */
+class TopologyConfig
+{
+public:
+
+    static TopologyConfig load(const std::string &path)
+    {
+        std::ifstream stream(path.c_str());
+        if (!stream.is_open())
+        {
+            throw std::runtime_error("Unable to open topology file " + path);
+        }
+        return parse(stream, path);
+    }
+
+    static TopologyConfig parse(std::istream &stream, const std::string &source)
+    {
+        TopologyConfig config;
+        std::string line;
+        for (size_t lineNumber = 1; std::getline(stream, line); lineNumber++)
+        {
+            std::istringstream tokens(line.substr(0, line.find('#')));
+            std::string type;
+            if (!(tokens >> type))
+            {
+                continue;
+            }
+
+            LayerConfig layer;
+            if (!parseType(type, layer.type))
+            {
+                throw std::runtime_error(error(source, lineNumber, "unknown layer type '" + type + "'"));
+            }
+
+            std::string token;
+            while (tokens >> token)
+            {
+                const size_t equals = token.find('=');
+                const std::string key = token.substr(0, equals);
+                const std::string value = equals == std::string::npos ? std::string() : token.substr(equals + 1);
+                bool valid = !value.empty();
+                if (key == "name") { layer.name = value; }
+                else if (key == "kernels" || key == "outputs") { valid = valid && parseSize(value, layer.outputs); }
+                else if (key == "kernel") { valid = valid && parsePair(value, layer.kernel); }
+                else if (key == "stride") { valid = valid && parsePair(value, layer.stride); }
+                else if (key == "padding") { valid = valid && parsePair(value, layer.padding); }
+                else { valid = false; }
+
+                if (!valid)
+                {
+                    throw std::runtime_error(error(source, lineNumber, "invalid parameter '" + token + "'"));
+                }
+            }
+
+            if ((layer.type == LayerConfig::convolution || layer.type == LayerConfig::fullyconnected) && layer.outputs == 0)
+            {
+                throw std::runtime_error(error(source, lineNumber, std::string(LayerConfig::getTypeName(layer.type)) +
+                                               " needs the number of " + (layer.type == LayerConfig::convolution ? "kernels" : "outputs")));
+            }
+            if (layer.kernel[0] == 0 || layer.kernel[1] == 0 || layer.stride[0] == 0 || layer.stride[1] == 0)
+            {
+                throw std::runtime_error(error(source, lineNumber, "kernel sizes and strides must be positive"));
+            }
+            if (layer.name.empty())
+            {
+                std::ostringstream name;
+                name << LayerConfig::getTypeName(layer.type) << config._layers.size() + 1;
+                layer.name = name.str();
+            }
+            config._layers.push_back(layer);
+        }
+
+        if (config._layers.empty() || config._layers.back().type != LayerConfig::softmax)
+        {
+            throw std::runtime_error("Topology " + source + " must end with a softmax layer");
+        }
+        for (size_t i = 0; i + 1 < config._layers.size(); i++)
+        {
+            if (config._layers[i].type == LayerConfig::softmax)
+            {
+                throw std::runtime_error("Topology " + source + " has softmax before the last layer");
+            }
+        }
+        return config;
+    }
+
+    /* The topology of the solution configureNet read from LENET_TOPOLOGY, kernel counts other than 0
+       replace the ones of the first two convolutions */
+    static TopologyConfig lenet(size_t kernels1 = 0, size_t kernels2 = 0)
+    {
+        TopologyConfig config = load(LENET_TOPOLOGY);
+        const size_t kernels[] = { kernels1, kernels2 };
+        for (size_t i = 0, c = 0; i < config._layers.size() && c < 2; i++)
+        {
+            if (config._layers[i].type == LayerConfig::convolution)
+            {
+                if (kernels[c] > 0)
+                {
+                    config._layers[i].outputs = kernels[c];
+                }
+                c++;
+            }
+        }
+        return config;
+    }
+
+    inline const std::vector<LayerConfig> &getLayers() const { return _layers; }
+
+    /* Names of the layers in the order of the topology, the indices of the built networks */
+    std::vector<std::string> getLayerNames() const
+    {
+        std::vector<std::string> names;
+        for (size_t i = 0; i < _layers.size(); i++)
+        {
+            names.push_back(_layers[i].name);
+        }
+        return names;
+    }
+
+    /* Shapes of all layers for objects of objectDims (channels, height, width), throws if a layer gets
+       an input smaller than its kernel */
+    MemoryPlan plan(const Collection<size_t> &objectDims, size_t batchSize, size_t typeSize, bool training = true) const
+    {
+        if (objectDims.size() != 3)
+        {
+            throw std::runtime_error("Topology needs objects of three dimensions");
+        }
+
+        MemoryPlan memoryPlan;
+        memoryPlan.batchSize = batchSize;
+        size_t dims[3] = { objectDims[0], objectDims[1], objectDims[2] };
+        memoryPlan.inputBytes = batchSize * dims[0] * dims[1] * dims[2] * typeSize;
+
+        for (size_t i = 0; i < _layers.size(); i++)
+        {
+            const LayerConfig &layer = _layers[i];
+            LayerPlan layerPlan;
+            layerPlan.name = layer.name;
+            layerPlan.type = layer.type;
+            layerPlan.numOfParameters = 0;
+
+            const size_t inputSize = dims[0] * dims[1] * dims[2];
+            size_t auxiliarySize = 0;
+            switch (layer.type)
+            {
+            case LayerConfig::convolution:
+                layerPlan.numOfParameters = layer.outputs * (dims[0] * layer.kernel[0] * layer.kernel[1] + 1);
+                dims[0] = layer.outputs;
+                slide(layer, dims);
+                break;
+            case LayerConfig::maxpooling:
+                slide(layer, dims);
+                auxiliarySize = dims[0] * dims[1] * dims[2];
+                break;
+            case LayerConfig::fullyconnected:
+                layerPlan.numOfParameters = layer.outputs * (inputSize + 1);
+                dims[0] = layer.outputs;
+                dims[1] = dims[2] = 1;
+                break;
+            default:
+                break;
+            }
+
+            const size_t outputSize = dims[0] * dims[1] * dims[2];
+            layerPlan.outputDims[0] = dims[0];
+            layerPlan.outputDims[1] = dims[1];
+            layerPlan.outputDims[2] = dims[2];
+            layerPlan.activationBytes = batchSize * (outputSize + (training ? inputSize + auxiliarySize : 0)) * typeSize;
+            layerPlan.parameterBytes = layerPlan.numOfParameters * typeSize * (training ? 2 : 1);
+            memoryPlan.layers.push_back(layerPlan);
+        }
+        return memoryPlan;
+    }
+
+    template<typename FPType>
+    training::TopologyPtr buildTraining() const
+    {
+        typedef initializers::uniform::Batch<FPType> UniformInitializer;
+        typedef SharedPtr<UniformInitializer> UniformInitializerPtr;
+        typedef initializers::xavier::Batch<FPType> XavierInitializer;
+        typedef SharedPtr<XavierInitializer> XavierInitializerPtr;
+
+        training::TopologyPtr topology(new training::Topology());
+        for (size_t i = 0; i < _layers.size(); i++)
+        {
+            const LayerConfig &layer = _layers[i];
+            size_t index = 0;
+            switch (layer.type)
+            {
+            case LayerConfig::convolution:
+            {
+                SharedPtr<convolution2d::Batch<FPType> > convolution(new convolution2d::Batch<FPType>());
+                setConvolution(convolution->parameter, layer);
+                convolution->parameter.weightsInitializer = XavierInitializerPtr(new XavierInitializer());
+                convolution->parameter.biasesInitializer = UniformInitializerPtr(new UniformInitializer(0, 0));
+                index = topology->add(convolution);
+                break;
+            }
+            case LayerConfig::maxpooling:
+            {
+                SharedPtr<maximum_pooling2d::Batch<FPType> > pooling(new maximum_pooling2d::Batch<FPType>(4));
+                setPooling(pooling->parameter, layer);
+                index = topology->add(pooling);
+                break;
+            }
+            case LayerConfig::fullyconnected:
+            {
+                SharedPtr<fullyconnected::Batch<FPType> > fullyConnected(new fullyconnected::Batch<FPType>(layer.outputs));
+                fullyConnected->parameter.weightsInitializer = XavierInitializerPtr(new XavierInitializer());
+                fullyConnected->parameter.biasesInitializer = UniformInitializerPtr(new UniformInitializer(0, 0));
+                index = topology->add(fullyConnected);
+                break;
+            }
+            case LayerConfig::relu:
+                index = topology->add(SharedPtr<relu::Batch<FPType> >(new relu::Batch<FPType>));
+                break;
+            case LayerConfig::softmax:
+                index = topology->add(SharedPtr<loss::softmax_cross::Batch<FPType> >(new loss::softmax_cross::Batch<FPType>()));
+                break;
+            }
+            if (i > 0)
+            {
+                topology->get(index - 1).addNext(index);
+            }
+        }
+        return topology;
+    }
+
+    /*Forward-only topology with the layer indices of buildTraining, the loss layer is replaced by softmax*/
+    template<typename FPType>
+    prediction::TopologyPtr buildPrediction() const
+    {
+        prediction::TopologyPtr topology(new prediction::Topology());
+        for (size_t i = 0; i < _layers.size(); i++)
+        {
+            const LayerConfig &layer = _layers[i];
+            size_t index = 0;
+            switch (layer.type)
+            {
+            case LayerConfig::convolution:
+            {
+                SharedPtr<convolution2d::forward::Batch<FPType> > convolution(new convolution2d::forward::Batch<FPType>());
+                setConvolution(convolution->parameter, layer);
+                index = topology->add(convolution);
+                break;
+            }
+            case LayerConfig::maxpooling:
+            {
+                SharedPtr<maximum_pooling2d::forward::Batch<FPType> > pooling(new maximum_pooling2d::forward::Batch<FPType>(4));
+                setPooling(pooling->parameter, layer);
+                index = topology->add(pooling);
+                break;
+            }
+            case LayerConfig::fullyconnected:
+                index = topology->add(SharedPtr<fullyconnected::forward::Batch<FPType> >(
+                                          new fullyconnected::forward::Batch<FPType>(layer.outputs)));
+                break;
+            case LayerConfig::relu:
+                index = topology->add(SharedPtr<relu::forward::Batch<FPType> >(new relu::forward::Batch<FPType>));
+                break;
+            case LayerConfig::softmax:
+                index = topology->add(SharedPtr<softmax::forward::Batch<FPType> >(new softmax::forward::Batch<FPType>()));
+                break;
+            }
+            if (i > 0)
+            {
+                topology->get(index - 1).addNext(index);
+            }
+        }
+        return topology;
+    }
+
+private:
+
+    std::vector<LayerConfig> _layers;
+
+    static std::string error(const std::string &source, size_t lineNumber, const std::string &message)
+    {
+        std::ostringstream stream;
+        stream << "Topology " << source << " line " << lineNumber << ": " << message;
+        return stream.str();
+    }
+
+    static bool parseType(const std::string &name, LayerConfig::Type &type)
+    {
+        for (int t = LayerConfig::convolution; t <= LayerConfig::softmax; t++)
+        {
+            if (name == LayerConfig::getTypeName((LayerConfig::Type)t))
+            {
+                type = (LayerConfig::Type)t;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool parseSize(const std::string &value, size_t &size)
+    {
+        char *end = NULL;
+        unsigned long parsed = strtoul(value.c_str(), &end, 10);
+        if (end == value.c_str() || *end != '\0' || value[0] == '-')
+        {
+            return false;
+        }
+        size = parsed;
+        return true;
+    }
+
+    static bool parsePair(const std::string &value, size_t pair[2])
+    {
+        const size_t x = value.find('x');
+        if (x == std::string::npos)
+        {
+            return parseSize(value, pair[0]) && parseSize(value, pair[1]);
+        }
+        return parseSize(value.substr(0, x), pair[0]) && parseSize(value.substr(x + 1), pair[1]);
+    }
+
+    /* Output size of a kernel sliding over the height and width of dims */
+    static void slide(const LayerConfig &layer, size_t dims[3])
+    {
+        for (size_t d = 0; d < 2; d++)
+        {
+            const size_t padded = dims[d + 1] + 2 * layer.padding[d];
+            if (padded < layer.kernel[d])
+            {
+                throw std::runtime_error("Layer " + layer.name + " gets an input smaller than its kernel");
+            }
+            dims[d + 1] = (padded - layer.kernel[d]) / layer.stride[d] + 1;
+        }
+    }
+
+    template<typename Parameter>
+    static void setConvolution(Parameter &parameter, const LayerConfig &layer)
+    {
+        parameter.kernelSizes = convolution2d::KernelSizes(layer.kernel[0], layer.kernel[1]);
+        parameter.strides = convolution2d::Strides(layer.stride[0], layer.stride[1]);
+        parameter.paddings = convolution2d::Paddings(layer.padding[0], layer.padding[1]);
+        parameter.nKernels = layer.outputs;
+    }
+
+    template<typename Parameter>
+    static void setPooling(Parameter &parameter, const LayerConfig &layer)
+    {
+        parameter.kernelSizes = pooling2d::KernelSizes(layer.kernel[0], layer.kernel[1]);
+        parameter.strides = pooling2d::Strides(layer.stride[0], layer.stride[1]);
+        parameter.paddings = pooling2d::Paddings(layer.padding[0], layer.padding[1]);
+    }
+};
+
+#endif
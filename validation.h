@@ -0,0 +1,300 @@
+/* file: validation.h */
+/*
+//               INTEL CORPORATION PROPRIETARY INFORMATION
+//  This software is supplied under the terms of a license agreement or
+//  nondisclosure agreement with Intel Corporation and may not be copied
+//  or disclosed except in accordance with the terms of that agreement.
+//    Copyright (C) 2014-2016 Intel Corporation. All Rights Reserved.
+*/
+
+/*
+!  Content:
+!    Validation on objects held out of the train set, run by a background thread on copies
+!    of the weights, and early stopping on a target accuracy or a plateau of the loss
+!******************************************************************************/
+
+#ifndef _VALIDATION_H
+#define _VALIDATION_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <tbb/task_arena.h>
+#include "daal.h"
+#include "batch_pipeline.h"
+#include "evaluation.h"
+#include "tensor_pool.h"
+
+using namespace daal;
+using namespace daal::algorithms;
+using namespace daal::algorithms::neural_networks;
+using namespace daal::services;
+using namespace daal::data_management;
+
+struct ValidationParameters
+{
+    /* Objects at the end of the train set that are held out of the training, 0 disables validation */
+    size_t holdoutSize;
+    /* Chunks of minibatches between validations, one also runs after every epoch. 0 validates after epochs only */
+    size_t interval;
+    /* Stop once the validation accuracy reaches this, 0 disables the target */
+    double targetAccuracy;
+    /* Stop after this many validations in a row that do not lower the best validation loss by more
+       than minDelta, 0 disables the plateau detection */
+    size_t patience;
+    double minDelta;
+
+    ValidationParameters() : holdoutSize(0), interval(0), targetAccuracy(0), patience(0), minDelta(0) { }
+
+    inline bool isEnabled() const { return holdoutSize > 0; }
+};
+
+/* One validation and the point in the training of the weights it was run on */
+struct ValidationRecord
+{
+    size_t epoch;
+    /* Chunks of the epoch trained on */
+    size_t chunk;
+    size_t numOfMinibatches;
+    double loss;
+    double accuracy;
+    /* Seconds the validation took in the background */
+    double time;
+};
+
+/* Validates copies of the weights on a background thread while the training goes on. A copy still
+   waiting for the thread is replaced by a newer one, so the trainer never waits for a validation.
+   The thread runs its DAAL and TBB work in an arena as large as the one of the trainer */
+template<typename FPType>
+class AsyncValidator
+{
+public:
+
+    AsyncValidator(const SharedPtr<TensorChunk<FPType> > &holdout, const ValidationParameters &parameters,
+                   bool verbose = false) :
+        _holdout(holdout), _parameters(parameters), _verbose(verbose),
+        _concurrency(tbb::this_task_arena::max_concurrency()), _pending(false), _validating(false), _stopping(false),
+        _stop(false), _bestLoss(0), _numOfStale(0), _numOfSkipped(0), _validationTime(0)
+    {
+        _thread = std::thread(&AsyncValidator::run, this);
+    }
+
+    ~AsyncValidator()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _condition.notify_all();
+        _thread.join();
+    }
+
+    /* Copies the weights of the model and returns, the copy is validated in the background */
+    void snapshot(const training::ModelPtr &model, size_t epoch, size_t chunk, size_t numOfMinibatches)
+    {
+        prediction::ModelPtr copy = copyModel(model);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_pending)
+            {
+                _numOfSkipped++;
+            }
+            _snapshot = copy;
+            ValidationRecord record = { epoch, chunk, numOfMinibatches, 0, 0, 0 };
+            _snapshotRecord = record;
+            _pending = true;
+        }
+        _condition.notify_all();
+    }
+
+    /* Blocks until the last snapshot is validated */
+    void flush()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _condition.wait(lock, [this] { return !_pending && !_validating; });
+        if (!_error.empty())
+        {
+            throw std::runtime_error(_error);
+        }
+    }
+
+    /* True once a validation reached the target accuracy or the loss stopped improving */
+    bool shouldStop()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stop;
+    }
+
+    std::string getStopReason()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stopReason;
+    }
+
+    /* Validations in the order they were run */
+    std::vector<ValidationRecord> getHistory()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _history;
+    }
+
+    /* Snapshots replaced by a newer one before they were validated */
+    inline size_t getNumberOfSkipped() { return _numOfSkipped; }
+    inline double getValidationTime() { return _validationTime; }
+
+private:
+
+    /* Prediction model whose weights and biases are copies, the training goes on updating its own */
+    static prediction::ModelPtr copyModel(const training::ModelPtr &model)
+    {
+        prediction::ModelPtr copy = model->template getPredictionModel<FPType>();
+        SharedPtr<ForwardLayers> forwardLayers = copy->getLayers();
+        const layers::forward::InputId inputs[] = { layers::forward::weights, layers::forward::biases };
+        for (size_t i = 0; i < forwardLayers->size(); i++)
+        {
+            layers::forward::Input *layerInput = forwardLayers->get(i)->getLayerInput();
+            for (size_t j = 0; j < 2; j++)
+            {
+                TensorPtr tensor = layerInput->get(inputs[j]);
+                if (!tensor || tensor->getSize() == 0) { continue; }
+
+                SharedPtr<HomogenTensor<FPType> > clone = makePooledTensor<FPType>(tensor->getDimensions());
+                SubtensorDescriptor<FPType> block;
+                tensor->getSubtensor(0, 0, 0, tensor->getDimensionSize(0), readOnly, block);
+                std::copy(block.getPtr(), block.getPtr() + block.getSize(), clone->getArray());
+                tensor->releaseSubtensor(block);
+                layerInput->set(inputs[j], clone);
+            }
+        }
+        return copy;
+    }
+
+    void run()
+    {
+        tbb::task_arena arena(_concurrency);
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;)
+        {
+            _condition.wait(lock, [this] { return _pending || _stopping; });
+            if (!_pending)
+            {
+                return;
+            }
+            prediction::ModelPtr model = _snapshot;
+            ValidationRecord record = _snapshotRecord;
+            _snapshot = prediction::ModelPtr();
+            _pending = false;
+            _validating = true;
+
+            lock.unlock();
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::string error;
+            try
+            {
+                arena.execute([&]()
+                {
+                    prediction::Batch<FPType> net;
+                    net.input.set(prediction::model, model);
+                    net.input.set(prediction::data, _holdout->data);
+                    net.compute();
+                    Evaluation evaluation = evaluate<FPType>(net.getResult(), _holdout->groundTruth, 1);
+                    record.loss = evaluation.getLoss();
+                    record.accuracy = evaluation.getAccuracy();
+                });
+            }
+            catch (std::exception &e)
+            {
+                error = e.what();
+            }
+            record.time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            model = prediction::ModelPtr();
+            lock.lock();
+
+            _validating = false;
+            _validationTime += record.time;
+            if (error.empty())
+            {
+                update(record);
+            }
+            else
+            {
+                _error = error;
+            }
+            _condition.notify_all();
+        }
+    }
+
+    /* Records a validation and decides whether the training should stop, called under the lock */
+    void update(const ValidationRecord &record)
+    {
+        _history.push_back(record);
+        if (_history.size() == 1 || record.loss < _bestLoss - _parameters.minDelta)
+        {
+            _bestLoss = record.loss;
+            _numOfStale = 0;
+        }
+        else
+        {
+            _numOfStale++;
+        }
+
+        if (_verbose)
+        {
+            printf("Validation after epoch %lu chunk %lu: loss %.4f, accuracy %.4f, %.3f s\n", (unsigned long)record.epoch,
+                   (unsigned long)record.chunk, record.loss, record.accuracy, record.time);
+        }
+
+        if (_stop)
+        {
+            return;
+        }
+        char reason[128];
+        if (_parameters.targetAccuracy > 0 && record.accuracy >= _parameters.targetAccuracy)
+        {
+            snprintf(reason, sizeof(reason), "validation accuracy %.4f reached the target %.4f",
+                     record.accuracy, _parameters.targetAccuracy);
+            _stop = true;
+        }
+        else if (_parameters.patience > 0 && _numOfStale >= _parameters.patience)
+        {
+            snprintf(reason, sizeof(reason), "validation loss did not improve on %.4f in %lu validations",
+                     _bestLoss, (unsigned long)_numOfStale);
+            _stop = true;
+        }
+        if (_stop)
+        {
+            _stopReason = reason;
+        }
+    }
+
+    AsyncValidator(const AsyncValidator &);
+    AsyncValidator &operator=(const AsyncValidator &);
+
+    SharedPtr<TensorChunk<FPType> > _holdout;
+    ValidationParameters _parameters;
+    bool _verbose;
+    int _concurrency;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    prediction::ModelPtr _snapshot;
+    ValidationRecord _snapshotRecord;
+    bool _pending;
+    bool _validating;
+    bool _stopping;
+    bool _stop;
+    std::string _stopReason;
+    std::string _error;
+    std::vector<ValidationRecord> _history;
+    double _bestLoss;
+    size_t _numOfStale;
+    size_t _numOfSkipped;
+    double _validationTime;
+};
+
+#endif